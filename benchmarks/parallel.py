@@ -0,0 +1,75 @@
+#! /usr/bin/env python3
+
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+"""Compare serial and parallel graph queries on a random call graph.
+
+Run as "python3 -m benchmarks.parallel" from the top of the source tree.
+Speedups are only expected on a free-threaded Python; elsewhere the
+parallel queries fall back to serial execution.
+
+The speedup has not been measured yet: so far the benchmark was only
+run on single-CPU machines with the GIL, where --jobs greater than 1
+runs the parallel code but cannot make it faster."""
+
+import argparse
+import os
+import random
+import time
+
+import vrc
+
+
+def generate(nodes: int, edges: int, seed: int) -> vrc.Graph:
+    rnd = random.Random(seed)
+    graph = vrc.Graph()
+    names = [f"f{i}" for i in range(nodes)]
+    for name in names:
+        graph.add_node(name)
+    for _ in range(edges):
+        # Bias callees towards low-numbered nodes, like library functions
+        caller = rnd.randrange(nodes)
+        callee = int(nodes * rnd.random() ** 2)
+        graph.add_edge(names[caller], names[callee], "call")
+    return graph
+
+
+def measure(fn) -> float:
+    start = time.perf_counter()
+    fn()
+    return time.perf_counter() - start
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--nodes", type=int, default=100000)
+    parser.add_argument("--edges", type=int, default=1000000)
+    parser.add_argument("--jobs", type=int, default=os.cpu_count() or 1)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    print(f"free-threaded: {vrc.free_threaded()}, jobs: {args.jobs}")
+    t = time.perf_counter()
+    graph = generate(args.nodes, args.edges, args.seed)
+    print(f"generated {args.nodes} nodes, {args.edges} edges in {time.perf_counter() - t:.2f}s")
+
+    rnd = random.Random(args.seed)
+    names = list(graph.nodes.keys())
+    roots = rnd.sample(names, 64)
+    sample = rnd.sample(names, 20000)
+    queries = {
+        "bfs": lambda: graph.bfs(roots, vrc.Graph._callees),
+        "closures": lambda: graph.closures(roots[:8], callers=True),
+        "metrics": lambda: graph.metrics(sample),
+    }
+
+    for name, fn in queries.items():
+        vrc.JOBS = 1
+        serial = measure(fn)
+        vrc.JOBS = args.jobs
+        parallel = measure(fn)
+        print(f"{name:10} serial {serial:7.3f}s  parallel {parallel:7.3f}s  speedup {serial / parallel:5.2f}x")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,112 @@
+#! /usr/bin/env python3
+
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+"""Compare full and slim RTL dumps of the same translation units.
+
+Run as "python3 -m benchmarks.slim [compile_commands.json]" from the top
+of the source tree.  Without a compilation database, a synthetic C++
+project is generated in a temporary directory.  Each file is compiled
+twice, and the size of the dumps and the time to compile and parse them
+are reported, together with a check that both graphs are the same."""
+
+import argparse
+import glob
+import json
+import os
+import random
+import shlex
+import subprocess
+import tempfile
+import time
+
+import vrc
+
+
+def generate(directory: str, files: int, functions: int, seed: int) -> list[dict[str, str]]:
+    rnd = random.Random(seed)
+    with open(os.path.join(directory, "common.h"), "w") as f:
+        f.write("template <typename T> struct box {\n"
+                "    T v;\n"
+                "    __attribute__((noinline)) T get() const { return v; }\n"
+                "    __attribute__((noinline)) void put(T x) { v = x; }\n"
+                "};\n"
+                "int ext(int);\n")
+    entries = []
+    for i in range(files):
+        source = f"t{i}.cc"
+        with open(os.path.join(directory, source), "w") as f:
+            f.write('#include "common.h"\n')
+            for j in range(functions):
+                f.write(f"__attribute__((noinline)) int f{i}_{j}(int x) {{\n"
+                        f"    box<int> b; b.put(x);\n")
+                for k in rnd.sample(range(j), min(j, 3)):
+                    f.write(f"    x += f{i}_{k}(x ^ {k}) * ext(x);\n")
+                f.write("    return x + b.get();\n}\n")
+        entries.append({"directory": directory, "file": source, "output": f"t{i}.o",
+                        "command": f"g++ -O2 -c {source} -o t{i}.o"})
+    return entries
+
+
+def compile_and_parse(entry: dict[str, str], outfile: str, slim: bool) -> tuple[float, int, float, vrc.Graph]:
+    command = entry["command"] if "command" in entry else shlex.join(entry["arguments"])
+    cmdline = vrc.build_gcc_S_command_line(command, outfile, slim)
+    start = time.perf_counter()
+    subprocess.run(cmdline, stdin=subprocess.DEVNULL, cwd=entry["directory"], check=True)
+    compile_time = time.perf_counter() - start
+
+    graph = vrc.Graph()
+    dumps = glob.glob(outfile + ".*r.expand")
+    start = time.perf_counter()
+    for fn in dumps:
+        with open(fn, "r") as f:
+            graph.parse(fn, f, verbose_print=lambda *args: None)
+    parse_time = time.perf_counter() - start
+    size = sum(os.path.getsize(fn) for fn in dumps)
+    return compile_time, size, parse_time, graph
+
+
+def summary(graph: vrc.Graph) -> dict[str, tuple[int, dict[str, str]]]:
+    return {name: (node.size, node.callees) for name, node in graph.nodes.items()}
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("compdb", nargs="?", help="compile_commands.json of the project to be measured")
+    parser.add_argument("--files", type=int, default=8, help="Files in the synthetic project")
+    parser.add_argument("--functions", type=int, default=200, help="Functions in each synthetic file")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        if args.compdb:
+            with open(args.compdb, "r") as f:
+                entries = [entry for entry in json.load(f) if "output" in entry]
+        else:
+            entries = generate(tmp, args.files, args.functions, args.seed)
+
+        totals: dict[bool, list[float]] = {False: [0.0, 0, 0.0], True: [0.0, 0, 0.0]}
+        mismatches = 0
+        for i, entry in enumerate(entries):
+            graphs = {}
+            for slim in (False, True):
+                outfile = os.path.join(tmp, f"{i}.{'slim' if slim else 'full'}")
+                compile_time, size, parse_time, graphs[slim] = compile_and_parse(entry, outfile, slim)
+                totals[slim][0] += compile_time
+                totals[slim][1] += size
+                totals[slim][2] += parse_time
+            if summary(graphs[False]) != summary(graphs[True]):
+                print(f"{entry['file']}: graphs differ")
+                mismatches += 1
+
+    print(f"{len(entries)} files, {mismatches} with different graphs")
+    for slim in (False, True):
+        compile_total, size_total, parse_total = totals[slim]
+        print(f"{'slim' if slim else 'full':5} compile {compile_total:7.3f}s  dump {size_total / 1e6:8.2f} MB  "
+              f"parse {parse_total:7.3f}s")
+    print(f"dump size ratio {totals[True][1] / max(1, totals[False][1]):.2f}, "
+          f"parse time ratio {totals[True][2] / max(1e-9, totals[False][2]):.2f}")
+
+
+if __name__ == "__main__":
+    main()
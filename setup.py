@@ -15,6 +15,10 @@ setup(
     entry_points={
         'console_scripts': [
             'vrc = vrc:main',
-        ]
+            'vrc-cc = vrc:cc_main',
+        ],
+        'pytest11': [
+            'vrc = vrc.pytest_plugin',
+        ],
     }
 )
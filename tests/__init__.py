@@ -1,7 +1,41 @@
+import argparse
+import concurrent.futures
+import io
+import json
+import os
+import random
+import struct
+import subprocess
+import tempfile
+import time
 import unittest
+from unittest import mock
 import vrc
 
 
+def dump(*funcs: tuple[str, list[str]]) -> list[str]:
+    """Build a minimal RTL dump with the given functions and calls."""
+    lines = []
+    for name, callees in funcs:
+        lines.append(f";; Function {name} ({name}, funcdef_no=0, decl_uid=1, cgraph_uid=1, symbol_order=0)\n")
+        lines.append("\n")
+        lines.append(";; Full RTL generated for this function:\n")
+        for callee in callees:
+            lines.append(f'(call_insn 5 4 6 2 (call (mem:QI (symbol_ref:DI ("{callee}") [flags 0x41]  <function_decl 0x7f0000000000 {callee}>) [0 {callee} S1 A8])\n')
+            lines.append(f'     (expr_list:REG_CALL_DECL (symbol_ref:DI ("{callee}") [flags 0x41]  <function_decl 0x7f0000000000 {callee}>)\n')
+    return lines
+
+
+def mark(lines: list[str], name: str, frequency: str) -> None:
+    """Add a frequency such as "hot" to the header of a function in a dump."""
+    i = next(i for i, line in enumerate(lines) if line.startswith(f";; Function {name} "))
+    lines[i] = lines[i].rstrip("\n") + f" ({frequency})\n"
+
+
+def ignore(*args) -> None:
+    pass
+
+
 class VRCGraphTest(unittest.TestCase):
     def test_edge_to_nonexisting_node(self):
         """Check creating an edge to a function that is not defined."""
@@ -200,3 +234,1016 @@ class VRCGraphTest(unittest.TestCase):
         self.assertEqual(sorted(graph.callers("c", False)), ["b"])
         self.assertEqual(sorted(graph.callees("b", False, False)), ["c"])
         # TODO: test that b -> c is the only edge left in the DOT output
+
+    def test_all_callees_deep(self):
+        """Check that recursive visits do not overflow the stack."""
+        graph = vrc.Graph()
+        for i in range(5000):
+            graph.add_node(str(i))
+            if i:
+                graph.add_edge(str(i - 1), str(i), "call")
+        self.assertEqual(len(list(graph.all_callees("0"))), 5000)
+        self.assertEqual(len(list(graph.all_callers("4999"))), 5000)
+
+    def test_bfs(self):
+        graph = vrc.Graph()
+        graph.add_node("a")
+        graph.add_node("b")
+        graph.add_node("c")
+        graph.add_node("d")
+        graph.add_edge("a", "b", "call")
+        graph.add_edge("b", "c", "call")
+        graph.add_edge("a", "c", "call")
+        graph.add_edge("d", "c", "call")
+        self.assertEqual(graph.bfs(["a"], vrc.Graph._callees), {"a": 0, "b": 1, "c": 1})
+        self.assertEqual(graph.closure(["c"], callers=True), {"a", "b", "c", "d"})
+        self.assertEqual(graph.closure(["b", "d"], callers=False), {"b", "c", "d"})
+
+    def test_parallel_queries(self):
+        """Check parallel queries against their serial counterparts."""
+        graph = vrc.Graph()
+        for i in range(200):
+            graph.add_node(str(i))
+        for i in range(200):
+            graph.add_edge(str(i), str(i * 7 % 200), "call")
+            graph.add_edge(str(i), str(i * 13 % 200), "call")
+        roots = [str(i) for i in range(0, 200, 10)]
+
+        old_jobs = vrc.JOBS
+        try:
+            vrc.JOBS = 1
+            dist = graph.bfs(roots, vrc.Graph._callees)
+            closures = graph.closures(roots, callers=True)
+            metrics = graph.metrics(roots, closure=True)
+            vrc.JOBS = 4
+            self.assertEqual(graph.bfs(roots, vrc.Graph._callees), dist)
+            self.assertEqual(graph.closures(roots, callers=True), closures)
+            self.assertEqual(graph.metrics(roots, closure=True), metrics)
+        finally:
+            vrc.JOBS = old_jobs
+
+    def test_closures_assembler_names(self):
+        graph = vrc.Graph()
+        graph.add_node("_Z1av", username="a")
+        graph.add_node("_Z1bv", username="b")
+        graph.add_edge("_Z1av", "_Z1bv", "call")
+        self.assertEqual(graph.closures(["a", "_Z1bv", "missing"], callers=False),
+                         {"_Z1av": {"_Z1av", "_Z1bv"}, "_Z1bv": {"_Z1bv"}})
+        self.assertEqual(graph.closures(["b"], callers=True)["_Z1bv"], graph.closure(["b"], callers=True))
+
+    def test_condensation_built_once(self):
+        graph = vrc.Graph()
+        graph.add_node("a")
+        graph.add_edge("a", "b", "call")
+        built = []
+
+        def build(g):
+            built.append(g)
+            time.sleep(0.05)
+            return real(g)
+
+        real = vrc.Condensation
+        with mock.patch("vrc.Condensation", side_effect=build), \
+                concurrent.futures.ThreadPoolExecutor(4) as pool:
+            results = list(pool.map(lambda _: graph.condensation(), range(4)))
+        self.assertEqual(len(built), 1)
+        self.assertTrue(all(cond is results[0] for cond in results))
+
+    def test_rwlock_writer_waiting(self):
+        """New readers wait for a waiting writer, but readers that already
+           hold the lock can take it again."""
+        lock = vrc.RWLock()
+        order = []
+        with concurrent.futures.ThreadPoolExecutor(2) as pool:
+            with lock.read():
+                def write() -> None:
+                    with lock.write():
+                        order.append("write")
+
+                def read() -> None:
+                    with lock.read():
+                        order.append("read")
+
+                writer = pool.submit(write)
+                while not lock._waiting:
+                    time.sleep(0.001)
+                reader = pool.submit(read)
+                time.sleep(0.05)
+                with lock.read():
+                    order.append("nested")
+            writer.result()
+            reader.result()
+        self.assertEqual(order, ["nested", "write", "read"])
+
+    def test_rwlock_read_then_write(self):
+        graph = vrc.Graph()
+        generation = graph.lock.generation
+        with graph.lock.read():
+            self.assertRaises(RuntimeError, graph.add_node, "a")
+        self.assertEqual(graph.lock.generation, generation)
+        # A writer can read, and then write again
+        with graph.lock.write(), graph.lock.read():
+            graph.add_node("a")
+        self.assertIn("a", graph.nodes)
+
+    def test_metrics(self):
+        graph = vrc.Graph()
+        graph.add_node("a")
+        graph.add_node("b")
+        graph.add_node("c")
+        graph.add_edge("a", "b", "call")
+        graph.add_edge("b", "c", "call")
+        graph.add_edge("a", "d", "call")
+        m = graph.metrics(["a", "b"], closure=True)
+        self.assertEqual(m["a"], vrc.NodeMetrics(callers=0, callees=1, all_callers=0, all_callees=3))
+        self.assertEqual(m["b"], vrc.NodeMetrics(callers=1, callees=1, all_callers=1, all_callees=1))
+
+    def test_communities(self):
+        graph = vrc.Graph()
+        for x in ["a1", "a2", "a3", "b1", "b2", "b3"]:
+            graph.add_node(x)
+        graph.add_edge("a1", "a2", "call")
+        graph.add_edge("a2", "a3", "call")
+        graph.add_edge("a3", "a1", "call")
+        graph.add_edge("b1", "b2", "call")
+        graph.add_edge("b2", "b3", "call")
+        graph.add_edge("b3", "b1", "call")
+        graph.add_edge("a1", "b1", "call")
+        label = graph.communities(graph.all_nodes(), ref_ok=False)
+        self.assertEqual(label["a1"], label["a2"])
+        self.assertEqual(label["a1"], label["a3"])
+        self.assertEqual(label["b1"], label["b2"])
+        self.assertEqual(label["b1"], label["b3"])
+        self.assertNotEqual(label["a1"], label["b1"])
+
+    def test_atlas(self):
+        graph = vrc.Graph()
+        graph.add_node("a", file="x.o.253r.expand")
+        graph.add_node("b", file="x.o.253r.expand")
+        graph.add_node("c", file="y.o.253r.expand")
+        graph.add_edge("a", "b", "call")
+        graph.add_edge("b", "c", "call")
+        with tempfile.TemporaryDirectory() as dir, mock.patch.object(vrc, "GRAPH", graph):
+            vrc.OutputCommand.write_atlas(dir, "file", False)
+            self.assertEqual(sorted(os.listdir(dir)), ["atlas.json", "index.dot", "x.o.dot", "y.o.dot"])
+            with open(os.path.join(dir, "x.o.dot")) as f:
+                self.assertIn('"a" -> "b";', f.read())
+            with open(os.path.join(dir, "index.dot")) as f:
+                self.assertIn('"x.o" -> "y.o" [label="1"];', f.read())
+
+            # Only the shard whose edges changed is rewritten
+            os.unlink(os.path.join(dir, "x.o.dot"))
+            os.unlink(os.path.join(dir, "y.o.dot"))
+            with open(os.path.join(dir, "y.o.dot"), "w"):
+                pass
+            graph.add_edge("a", "d", "call")
+            graph.add_node("d", file="x.o.253r.expand")
+            vrc.OutputCommand.write_atlas(dir, "file", False)
+            self.assertTrue(os.path.exists(os.path.join(dir, "x.o.dot")))
+            self.assertEqual(os.path.getsize(os.path.join(dir, "y.o.dot")), 0)
+
+            # Quotes and backslashes in names are escaped
+            graph.add_node('operator""_s', file="x.o.253r.expand")
+            graph.add_edge("a", 'operator""_s', "call")
+            graph.add_node("f<'\\0'>", file="x.o.253r.expand")
+            vrc.OutputCommand.write_atlas(dir, "file", False)
+            with open(os.path.join(dir, "x.o.dot")) as f:
+                text = f.read()
+            self.assertIn('"a" -> "operator\\"\\"_s";', text)
+            self.assertIn('"f<\'\\\\0\'>";', text)
+
+        self.assertRaises(argparse.ArgumentError, vrc.PARSER.parse_args, ["output", "--atlas", "dir", "out.dot"])
+
+    def test_largest_first(self):
+        """Known compilation times take precedence over source sizes."""
+        with tempfile.TemporaryDirectory() as dir:
+            for name, size in [("a.c", 100), ("b.c", 300), ("c.c", 200)]:
+                with open(os.path.join(dir, name), "w") as f:
+                    f.write("x" * size)
+            compdb = {
+                f"/{x}.o": vrc.CompdbEntry(directory=dir, file=f"{x}.c", command="")
+                for x in ["a", "b", "c"]
+            }
+            with mock.patch.dict(vrc.COMPDB, compdb), mock.patch.dict(vrc.COMPILE_TIMES, clear=True):
+                self.assertEqual(vrc.largest_first(compdb), ["/b.o", "/c.o", "/a.o"])
+                # 4.5 seconds for 300 bytes, so /b.o is estimated at 4.5 seconds
+                vrc.COMPILE_TIMES["/a.o"] = 2.5
+                vrc.COMPILE_TIMES["/c.o"] = 2
+                self.assertEqual(vrc.largest_first(compdb), ["/b.o", "/a.o", "/c.o"])
+
+    def test_translation_unit_key(self):
+        """Output and dependency file names do not affect the key."""
+        def key(command: str, file: str = "a.c") -> str:
+            return vrc.translation_unit_key(vrc.CompdbEntry(directory="/src", file=file, command=command))
+
+        base = key("gcc -O2 -c a.c -o a.o")
+        self.assertEqual(key("gcc -O2 -c a.c -o lib/a.o -MD -MF lib/a.o.d -MT lib/a.o"), base)
+        self.assertEqual(key("gcc -O2 -c a.c -olib/a.o -Wp,-MD,lib/.a.o.d"), base)
+        self.assertNotEqual(key("gcc -O2 -fPIC -c a.c -o lib/a.o"), base)
+        self.assertNotEqual(key("gcc -O2 -c a.c -o a.o", file="b.c"), base)
+
+    def test_parse(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b", "c"]), ("b", []))), ignore)
+        self.assertEqual(sorted(graph.callees("a", True, False)), ["b", "c"])
+        self.assertEqual(graph.nodes["a"]["b"], "call")
+        self.assertEqual(graph.nodes_by_file["a.o.253r.expand"], ["a", "b"])
+
+    def test_parse_slim(self):
+        lines = [
+            ";; Function f (f, funcdef_no=1, decl_uid=1989, cgraph_uid=2, symbol_order=2)\n",
+            ";; Full RTL generated for this function:\n",
+            "    1: NOTE_INSN_DELETED\n",
+            "    9: di:SI=r85:SI\n",
+            "   10: ax:SI=call [`g'] argc:0\n",
+            "   12: r86:DI=`h'\n",
+            "   18: barrier\n",
+            "   19: L19:\n",
+            "   20: debug begin stmt marker\n",
+            "   22: {ax:SI=call [`h'] argc:0;clobber flags:CC;}\n",
+            "   23: r87:DI=`*.LC0'\n",
+        ]
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(lines), ignore)
+        self.assertEqual(graph.nodes["f"].callees, {"g": "call", "h": "call", "*.LC0": "ref"})
+        self.assertEqual(graph.nodes["f"].calls, {"g": 1, "h": 1})
+        self.assertEqual(graph.nodes["f"].size, 5)
+        self.assertIn("-fdump-rtl-expand-slim", vrc.build_gcc_S_command_line("gcc -c a.c -o a.o", "a.o", slim=True))
+
+    def test_parse_duplicate(self):
+        """Only the first definition of a function is scanned."""
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("inl", ["b"]), ("a", ["inl"]))), ignore)
+        graph.parse("c.o.253r.expand", iter(dump(("inl", ["d"]), ("c", ["inl"]))), ignore)
+        self.assertEqual(sorted(graph.callees("inl", True, False)), ["b"])
+        self.assertNotIn("d", graph.nodes)
+        self.assertEqual(graph.nodes_by_file["c.o.253r.expand"], ["c"])
+        self.assertEqual(sorted(graph.callers("inl", False)), ["a", "c"])
+        self.assertEqual(graph.nodes["inl"].copies, 2)
+
+        records = b"".join(vrc.extract_records("e.o.253r.expand", iter(dump(("inl", ["e"]))), False))
+        graph.parse_records(io.StringIO(records.decode()), ignore)
+        self.assertEqual(sorted(graph.callees("inl", True, False)), ["b"])
+        self.assertEqual(graph.nodes["inl"].copies, 3)
+
+    def test_parse_verify_duplicates(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("inl", ["b"]))), ignore)
+        with mock.patch("sys.stderr", new_callable=io.StringIO) as stderr:
+            # A different size alone is not reported
+            graph.parse("c.o.253r.expand", iter(dump(("inl", ["b", "b"]))), ignore, verify_duplicates=True)
+            self.assertEqual(stderr.getvalue(), "")
+            graph.parse("d.o.253r.expand", iter(dump(("inl", ["b", "d"]))), ignore, verify_duplicates=True)
+            self.assertIn("edges of inl differ", stderr.getvalue())
+            records = b"".join(vrc.extract_records("e.o.253r.expand", iter(dump(("inl", ["e"]))), False))
+            graph.parse_records(io.StringIO(records.decode()), ignore, verify_duplicates=True)
+        self.assertEqual(sorted(graph.callees("inl", True, False)), ["b", "d", "e"])
+        # Only the call sites of the new callees are added
+        self.assertEqual(graph.nodes["inl"].calls, {"b": 1, "d": 1, "e": 1})
+        self.assertEqual(graph.nodes["inl"].copies, 4)
+
+    def test_parse_local_duplicates(self):
+        """Static functions with the same name in two files are different nodes."""
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["helper"]), ("helper", ["b"]))), ignore,
+                    local={"helper"})
+        graph.parse("d.o.253r.expand", iter(dump(("d", ["helper"]), ("helper", ["e"]))), ignore,
+                    local={"helper"})
+        self.assertEqual(sorted(graph.callees("helper", True, False)), ["b"])
+        self.assertEqual(sorted(graph.callees("helper@d.o", True, False)), ["e"])
+        self.assertEqual(sorted(graph.callees("d", True, False)), ["helper@d.o"])
+        self.assertEqual(graph.nodes["helper@d.o"].username, "helper@d.o")
+        self.assertEqual(graph.nodes_by_file["d.o.253r.expand"], ["d", "helper@d.o"])
+
+        # A non-static copy is still a duplicate
+        graph.parse("f.o.253r.expand", iter(dump(("helper", ["f"]))), ignore)
+        self.assertNotIn("f", graph.nodes)
+
+        records = b"".join(vrc.extract_records("g.o.253r.expand", iter(dump(("g", ["helper"]), ("helper", ["h"]))),
+                                               False, local={"helper"}))
+        self.assertTrue(records.startswith(b"L\tg.o.253r.expand\thelper\n"))
+        graph.parse_records(io.StringIO(records.decode()), ignore)
+        self.assertEqual(sorted(graph.callees("g", True, False)), ["helper@g.o"])
+        self.assertEqual(sorted(graph.callees("helper@g.o", True, False)), ["h"])
+
+    def test_parse_copies(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("inl", ["b", "c"]), ("a", ["inl"]))), ignore)
+        graph.parse("c.o.253r.expand", iter(dump(("inl", ["b", "c", "d"]))), ignore)
+        self.assertEqual((graph.nodes["inl"].copies, graph.nodes["inl"].size, graph.nodes["inl"].total_size),
+                         (2, 2, 5))
+        self.assertEqual((graph.nodes["a"].copies, graph.nodes["a"].size), (1, 1))
+
+    def test_edge_weight(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b", "b", "c"]))), ignore)
+        self.assertEqual(graph.edge_weight("a", "b"), 2)
+        self.assertEqual(graph.edge_weight("a", "c"), 1)
+
+        # Use the profile if available.  The dump was generated by GCC 12.2 with
+        # "gcc -O2 -fprofile-use -c p.c -fdump-rtl-expand-blocks-details", where
+        # main() calls leaf() 1000 times in a loop and rare() never, after a
+        # -fprofile-generate build was run once.
+        fn = os.path.join(os.path.dirname(__file__), "profile-use.c.253r.expand")
+        with open(fn, "r") as f:
+            graph.parse(fn, f, ignore)
+        self.assertEqual(graph.edge_weight("main", "leaf"), 1000)
+        self.assertEqual(graph.edge_weight("main", "rare"), 0)
+        self.assertEqual(graph.nodes["main"].calls, {"leaf": 1, "rare": 1})
+
+        option = vrc.build_gcc_S_command_line("gcc -O2 -fprofile-use -c p.c -o p.o", "p.o")
+        self.assertIn("-fdump-rtl-expand-blocks-details", option)
+        option = vrc.build_gcc_S_command_line("gcc -O2 -c p.c -o p.o", "p.o", slim=True)
+        self.assertIn("-fdump-rtl-expand-slim", option)
+
+    def test_call_chain_clustering(self):
+        weights = {("main", "a"): 10, ("a", "b"): 5, ("main", "c"): 1, ("d", "e"): 100}
+        sizes = {f: 100 for f in ["main", "a", "b", "c", "d", "e"]}
+        order = vrc.call_chain_clustering(weights, sizes, 4096)
+        self.assertEqual(order, ["d", "e", "main", "a", "b", "c"])
+
+        self.assertEqual(vrc.call_locality(order, weights, sizes, 4096), (1.0, 11800 / 116))
+
+        # Clusters are limited in size
+        order = vrc.call_chain_clustering(weights, sizes, 200)
+        self.assertEqual(order, ["d", "e", "b", "main", "a", "c"])
+        self.assertEqual(vrc.call_locality(order, weights, sizes, 200), (100 / 116, 12200 / 116))
+
+    def test_affinity_groups(self):
+        weights = {("a", "b"): 10, ("b", "c"): 1, ("c", "d"): 5, ("a", "d"): 2, ("e", "a"): 1}
+        files = ["a", "b", "c", "d", "e", "f"]
+        self.assertEqual(vrc.affinity_groups(files, weights, 2), [["a", "b"], ["c", "d"], ["e", "f"]])
+        # b-c and a-d add up to 3, more than e-a
+        self.assertEqual(vrc.affinity_groups(files, weights, 4), [["a", "b", "c", "d"], ["e", "f"]])
+        self.assertEqual(vrc.affinity_groups(files, weights, 1), [[f] for f in files])
+
+        # c has more weight with a than with d, but a and b were merged first
+        weights = {("d", "c"): 6, ("b", "d"): 8, ("d", "a"): 3, ("c", "a"): 6}
+        self.assertEqual(vrc.affinity_groups("abcd", weights, 3), [["a", "c", "d"], ["b"]])
+        # f moves from p/q/r to b1/b2, which makes room for z1/z2 next to p
+        weights = {("p", "q"): 20, ("q", "r"): 20, ("e1", "e2"): 20, ("e2", "e3"): 20, ("z1", "z2"): 20,
+                   ("r", "f"): 10, ("b1", "b2"): 8, ("f", "b1"): 6, ("f", "b2"): 6, ("z1", "p"): 1}
+        files = sorted({f for edge in weights for f in edge})
+        self.assertEqual(vrc.affinity_groups(files, weights, 5),
+                         [["b1", "b2", "f"], ["e1", "e2", "e3"], ["p", "q", "r", "z1", "z2"]])
+
+    def test_save_restore(self):
+        graph = vrc.Graph()
+        graph.parse("a.c.253r.expand", dump(("f", ["g"]), ("g", [])), verbose_print=ignore)
+        graph.omit_node("g")
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "graph")
+            graph.save(fn)
+            restored = vrc.Graph.restore(fn)
+        self.assertTrue(restored.has_edge("f", "g"))
+        self.assertFalse(restored.filter_node("g", True))
+        self.assertEqual(list(restored.all_nodes_for_file("a.c.253r.expand")), ["f"])
+        with restored.lock.write():
+            restored.add_edge("g", "f", "call")
+
+    def test_bisect_snapshots(self):
+        loaded = []
+
+        def load(path: str, verbose_print) -> vrc.Graph:
+            loaded.append(path)
+            graph = vrc.Graph()
+            graph.add_node("f")
+            if int(path) >= 5:
+                graph.add_edge("f", "g", "call")
+            return graph
+
+        snapshots = [str(i) for i in range(16)]
+        with mock.patch("vrc.load_snapshot", load):
+            self.assertEqual(vrc.bisect_snapshots(snapshots, lambda g: g.has_edge("f", "g"), ignore),
+                             (5, False, True))
+            self.assertLessEqual(len(loaded), 6)
+            self.assertIsNone(vrc.bisect_snapshots(snapshots[5:], lambda g: g.has_edge("f", "g"), ignore))
+
+    def test_bisect_metric(self):
+        graph = vrc.Graph()
+        graph.parse("a.c.253r.expand", dump(("f", ["g"]), ("g", ["h"]), ("size", [])), verbose_print=ignore)
+        parse = vrc.BisectMetricCommand.parse_metric
+
+        evaluate, snapshots = parse("all_callees", ["f", "s1", "s2"])
+        self.assertEqual((evaluate(graph), snapshots), (2, ["s1", "s2"]))
+        evaluate, snapshots = parse("all_callees", ["f", ">", "1", "s1"])
+        self.assertEqual((evaluate(graph), snapshots), (True, ["s1"]))
+        # Function names are never confused with metrics
+        evaluate, snapshots = parse("defined", ["size", "s1"])
+        self.assertTrue(evaluate(graph))
+        evaluate, snapshots = parse("edge", ["f", "g", "s1"])
+        self.assertTrue(evaluate(graph))
+        evaluate, snapshots = parse("nodes", ["==", "3", "s1"])
+        self.assertTrue(evaluate(graph))
+
+        self.assertRaises(argparse.ArgumentError, parse, "edge", ["f", "g"])
+        self.assertRaises(argparse.ArgumentError, parse, "nodes", [">", "x", "s1"])
+        self.assertRaises(argparse.ArgumentError, parse, "nodes", [">", "1"])
+
+        args = vrc.PARSER.parse_args(["bisect-metric", "callers", "foo.cold", "<", "3", "s1", "s2"])
+        self.assertEqual((args.metric, args.words), ("callers", ["foo.cold", "<", "3", "s1", "s2"]))
+
+    def test_extract_records(self):
+        lines = dump(("a", ["b", "b"]), ("b", []))
+        records = b"".join(vrc.extract_records("a.o.253r.expand", iter(lines), False))
+        self.assertEqual(records.decode().splitlines(), [
+            "F\ta.o.253r.expand\ta\ta\t2",
+            "E\ta\tb\tcall\t2\t",
+            "F\ta.o.253r.expand\tb\tb\t0",
+        ])
+        records = b"".join(vrc.extract_records("a.o.253r.expand", iter(lines), True))
+        fields = []
+        while records:
+            length = int.from_bytes(records[:4], "big")
+            fields.append(records[4:4 + length].split(b"\0"))
+            records = records[4 + length:]
+        self.assertEqual(fields[1], [b"E", b"a", b"b", b"call", b"2", b""])
+        self.assertEqual(len(fields), 3)
+
+        # A callee that is also referenced keeps the flag
+        lines = dump(("a", ["g"]), ("g", []))
+        lines.insert(3, '(insn 6 5 7 2 (set (reg:DI 82) (symbol_ref:DI ("g") [flags 0x3]  '
+                        '<function_decl 0x7f0000000000 g>)) "u.c":3:5 -1\n')
+        serial = vrc.Graph()
+        serial.parse("a.o.253r.expand", iter(lines), ignore)
+        records = b"".join(vrc.extract_records("a.o.253r.expand", iter(lines), False)).decode()
+        self.assertIn("E\ta\tg\tcall\t1\t\t1\n", records)
+        copy = vrc.Graph()
+        copy.parse_records(io.StringIO(records), ignore)
+        self.assertEqual(serial.address_taken(), {"g": ({"a.o.253r.expand"}, True)})
+        self.assertEqual(copy.address_taken(), serial.address_taken())
+
+    def test_store(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "a.o.253r.expand")
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", ["b", "b"]), ("b", []))))
+            store = os.path.join(tmp, "store")
+            vrc.store_dump(store, "/obj/a.o", fn)
+            vrc.store_dump(store, "/obj/a.o", fn)
+            vrc.store_dump(store, "/obj/b.o", fn)
+            self.assertEqual(len(os.listdir(store)), 2)
+
+            graph = vrc.Graph()
+            for stored in sorted(os.listdir(store)):
+                with open(os.path.join(store, stored), "r") as f:
+                    graph.parse_records(f, ignore)
+            self.assertEqual(graph.nodes["a"].file, "/obj/a.o")
+            self.assertEqual(graph.nodes["a"].calls, {"b": 2})
+            self.assertEqual(graph.nodes["a"].copies, 2)
+            self.assertEqual(graph.nodes["b"].callers, {"a"})
+
+    def test_store_failure(self):
+        """A failed store keeps its error and the compiler's exit status."""
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "a.o.253r.expand")
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", ["b"]), ("b", []))))
+
+            # The rename fails and the temporary file is already gone
+            def replace(src: str, dst: str) -> None:
+                os.unlink(src)
+                raise PermissionError(dst)
+
+            store = os.path.join(tmp, "store")
+            with mock.patch("os.replace", side_effect=replace):
+                self.assertRaises(PermissionError, vrc.store_dump, store, "/obj/a.o", fn)
+            self.assertEqual(os.listdir(store), [])
+
+            def compile(args: list[str]) -> subprocess.CompletedProcess:
+                with open(args[-1].split("=", 1)[1], "w") as f:
+                    f.write("".join(line + "\n" for line in dump(("a", []))))
+                return subprocess.CompletedProcess(args, 0)
+
+            for error in (PermissionError, RuntimeError):
+                with mock.patch("sys.argv", ["vrc-cc", "gcc", "-c", "a.c", "-o", "a.o"]), \
+                        mock.patch.dict("os.environ", {"VRC_STORE": store}), \
+                        mock.patch("subprocess.run", side_effect=compile), \
+                        mock.patch("vrc.store_dump", side_effect=error), \
+                        mock.patch("sys.stderr", io.StringIO()) as stderr:
+                    with self.assertRaises(SystemExit) as exit:
+                        vrc.cc_main()
+                self.assertEqual(exit.exception.code, 0)
+                self.assertIn("vrc-cc: could not store edges", stderr.getvalue())
+
+    def test_store_relative(self):
+        """Without an absolute store, vrc-cc only runs the compiler."""
+        environ = {k: v for k, v in os.environ.items() if k != "VRC_STORE"}
+        for env in (environ, dict(environ, VRC_STORE="store")):
+            with mock.patch("sys.argv", ["vrc-cc", "gcc", "-c", "a.c", "-o", "a.o"]), \
+                    mock.patch.dict("os.environ", env, clear=True), \
+                    mock.patch("subprocess.run", return_value=subprocess.CompletedProcess([], 1)) as run, \
+                    mock.patch("vrc.store_dump", side_effect=AssertionError), \
+                    mock.patch("sys.stderr", io.StringIO()) as stderr:
+                with self.assertRaises(SystemExit) as exit:
+                    vrc.cc_main()
+            self.assertEqual(exit.exception.code, 1)
+            run.assert_called_once_with(["gcc", "-c", "a.c", "-o", "a.o"])
+            self.assertIn("VRC_STORE must be an absolute directory", stderr.getvalue())
+
+    def test_parse_split(self):
+        lines = dump(*[(f"f{i}", [f"f{i + 1}", "ext"]) for i in range(20)], ("f3", ["g"]))
+        lines.insert(3, '(insn 6 5 7 2 (set (reg:DI 82) (symbol_ref:DI ("f1") [flags 0x3]  '
+                        '<function_decl 0x7f0000000000 f1>)) "u.c":3:5 -1\n')
+        mark(lines, "f7", "hot")
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "a.o.253r.expand")
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in lines))
+            ranges = vrc.split_dump(fn, 4)
+            self.assertEqual(len(ranges), 4)
+            self.assertEqual(ranges[0][0], 0)
+            self.assertEqual(ranges[-1][1], os.path.getsize(fn))
+
+            serial = vrc.Graph()
+            with open(fn, "r") as f:
+                serial.parse(fn, f, ignore)
+            split = vrc.Graph()
+            with concurrent.futures.ThreadPoolExecutor(2) as pool:
+                split.parse_split(fn, pool, 4, ignore)
+        self.assertEqual(list(split.nodes), list(serial.nodes))
+        self.assertEqual(split.nodes_by_file, serial.nodes_by_file)
+        for name, node in serial.nodes.items():
+            self.assertEqual(split.nodes[name], node)
+        self.assertEqual(split.address_taken(), serial.address_taken())
+        self.assertEqual(len(serial.address_taken()), 1)
+        self.assertNotIn("g", split.nodes)
+
+    def test_compile_output(self):
+        self.assertEqual(vrc.compile_output(["-O2", "-c", "x.c", "-o", "/o/x.o"]), "/o/x.o")
+        self.assertEqual(vrc.compile_output(["-c", "-I", "inc.c", "dir/x.cc"]), os.path.abspath("x.o"))
+        self.assertIsNone(vrc.compile_output(["x.c", "-o", "x"]))
+        self.assertIsNone(vrc.compile_output(["-c", "x.c", "y.c"]))
+
+    def test_source_memo(self):
+        def run(script: str) -> None:
+            args = vrc.PARSER.parse_args(["source", "--memo", script])
+            args.cmdclass().run(args)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "a.o.253r.expand")
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", ["b"]), ("b", ["c"]), ("c", []))))
+            script = os.path.join(tmp, "script")
+            with open(script, "w") as f:
+                f.write(f"# prefix\nload {fn}\nomit c\npwd\nnode d\n")
+
+            with mock.patch("vrc.GRAPH", vrc.Graph()), mock.patch("sys.stdout", io.StringIO()):
+                run(script)
+                self.assertIn("d", vrc.GRAPH.nodes)
+            with open(os.path.join(tmp, ".vrc-memo", "script.key"), "r") as f:
+                self.assertEqual(f.read().split()[0], "2")
+
+            # The dump is not parsed again, and the commands after the prefix run
+            with mock.patch("vrc.GRAPH", vrc.Graph()), mock.patch("sys.stdout", io.StringIO()), \
+                    mock.patch.object(vrc.Graph, "parse", side_effect=AssertionError), \
+                    mock.patch("sys.stderr", io.StringIO()):
+                run(script)
+                self.assertEqual(sorted(vrc.GRAPH.all_nodes()), ["a", "b", "d"])
+
+            # Changing the contents of an input invalidates the snapshot
+            with open(fn, "a") as f:
+                f.write(";; Function e (e, funcdef_no=4, decl_uid=4, cgraph_uid=4, symbol_order=4)\n")
+            with mock.patch("vrc.GRAPH", vrc.Graph()), mock.patch("sys.stdout", io.StringIO()):
+                run(script)
+                self.assertIn("e", vrc.GRAPH.nodes)
+
+    def test_source_memo_compdb(self):
+        def run(script: str) -> tuple[list[str], dict[str, float]]:
+            args = vrc.PARSER.parse_args(["source", "--memo", script])
+            with mock.patch("vrc.GRAPH", vrc.Graph()), mock.patch.dict("vrc.COMPDB", clear=True), \
+                    mock.patch.dict("vrc.EQUIVALENT_OBJECTS", clear=True), \
+                    mock.patch.dict("vrc.COMPILE_TIMES", clear=True), \
+                    mock.patch("vrc.COMPILE_TIMES_FILE", None), \
+                    mock.patch("sys.stdout", io.StringIO()), mock.patch("sys.stderr", io.StringIO()):
+                args.cmdclass().run(args)
+                return sorted(vrc.GRAPH.all_nodes()), dict(vrc.COMPILE_TIMES)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "a.o.253r.expand")
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", ["b"]), ("b", []))))
+            with open(os.path.join(tmp, "compile_commands.json"), "w") as f:
+                json.dump([{"directory": tmp, "file": "a.c", "output": "a.o",
+                            "command": "gcc -c a.c -o a.o"}], f)
+            with open(os.path.join(tmp, ".vrc-times.json"), "w") as f:
+                json.dump({os.path.join(tmp, "a.o"): 1.5}, f)
+            script = os.path.join(tmp, "script")
+            with open(script, "w") as f:
+                f.write(f"compdb {tmp}/compile_commands.json\nload --all\n")
+
+            fresh = run(script)
+            self.assertEqual(fresh, (["a", "b"], {os.path.join(tmp, "a.o"): 1.5}))
+            # The compile times are part of the saved state
+            with mock.patch.object(vrc.Graph, "parse", side_effect=AssertionError):
+                self.assertEqual(run(script), fresh)
+
+            # The dumps found through the compilation database are fingerprinted
+            with open(fn, "a") as f:
+                f.write(";; Function c (c, funcdef_no=4, decl_uid=4, cgraph_uid=4, symbol_order=4)\n")
+            self.assertEqual(run(script)[0], ["a", "b", "c"])
+
+    def test_load_all(self):
+        """Only compilations to objects are loaded, and a compiler that
+           cannot run does not stop the others."""
+        with tempfile.TemporaryDirectory() as tmp:
+            with open(os.path.join(tmp, "a.o.253r.expand"), "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", ["b"]), ("b", []))))
+            entries = [("a.c", "a.o", "gcc -c a.c -o a.o"),
+                       ("b.c", "b.o", "/nonexistent/gcc -c b.c -o b.o"),
+                       ("a.c", "a.i", "gcc -E a.c -o a.i"),
+                       ("a.c", "a.s", "gcc -S a.c -o a.s"),
+                       ("a.h", "a.h.gch", "gcc -c a.h -o a.h.gch")]
+            with open(os.path.join(tmp, "compile_commands.json"), "w") as f:
+                json.dump([{"directory": tmp, "file": file, "output": output, "command": command}
+                           for file, output, command in entries], f)
+
+            stderr = io.StringIO()
+            with mock.patch("vrc.GRAPH", vrc.Graph()), mock.patch.dict("vrc.COMPDB", clear=True), \
+                    mock.patch.dict("vrc.EQUIVALENT_OBJECTS", clear=True), \
+                    mock.patch.dict("vrc.COMPILE_TIMES", clear=True), \
+                    mock.patch("vrc.COMPILE_TIMES_FILE", None), mock.patch("sys.stderr", stderr):
+                for argv in (["compdb", os.path.join(tmp, "compile_commands.json")], ["load", "--all"]):
+                    args = vrc.PARSER.parse_args(argv)
+                    args.cmdclass().run(args)
+                self.assertEqual(vrc.compdb_objects(), [os.path.join(tmp, "a.o"), os.path.join(tmp, "b.o")])
+                self.assertEqual(sorted(vrc.GRAPH.all_nodes()), ["a", "b"])
+            self.assertRegex(stderr.getvalue(), r"Could not compile .*b\.o: ")
+
+    def test_call_graph(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("irq", ["ack", "log"]), ("ack", []), ("log", ["fmt"]),
+                                                 ("fmt", ["malloc"]), ("main", ["irq"]))), ignore)
+        api = vrc.CallGraph(graph)
+        self.assertEqual(api.functions(), {"irq", "ack", "log", "fmt", "main"})
+        self.assertEqual(api.callees("irq"), {"ack", "log"})
+        self.assertEqual(api.callers("irq"), {"main"})
+        self.assertEqual(api.reachable("log"), {"log", "fmt", "malloc"})
+        self.assertEqual(api.reaching("fmt"), {"fmt", "log", "irq", "main"})
+        self.assertEqual(api.path("irq", "malloc"), ["irq", "log", "fmt", "malloc"])
+        self.assertFalse(api.reaches("ack", "malloc"))
+        self.assertFalse(api.reaches("irq", "free"))
+        self.assertRaises(KeyError, api.reaches, "nmi", "malloc")
+
+        # The filter of the graph applies
+        graph.omit_node("log")
+        self.assertIsNone(api.path("irq", "malloc"))
+        self.assertNotIn("log", api)
+
+    def test_pytest_plugin_cache(self):
+        import vrc.pytest_plugin
+
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "dumps", "a.o.253r.expand")
+            os.mkdir(os.path.dirname(fn))
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", ["b"]), ("b", []))))
+            cache = os.path.join(tmp, "cache")
+            graph = vrc.pytest_plugin.load_cached([os.path.dirname(fn)], cache)
+            self.assertTrue(graph.reaches("a", "b"))
+
+            with mock.patch.object(vrc.Graph, "parse", side_effect=AssertionError):
+                graph = vrc.pytest_plugin.load_cached([os.path.dirname(fn)], cache)
+            self.assertEqual(graph.functions(), {"a", "b"})
+
+            with open(fn, "w") as f:
+                f.write("".join(line + "\n" for line in dump(("a", []), ("b", []))))
+            graph = vrc.pytest_plugin.load_cached([os.path.dirname(fn)], cache)
+            self.assertFalse(graph.reaches("a", "b"))
+            self.assertEqual(len([x for x in os.listdir(cache) if x.endswith(".pickle")]), 1)
+
+    def test_prefetcher(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b"]), ("b", ["c"]), ("c", []))), ignore)
+        prefetcher = vrc.Prefetcher()
+        prefetcher.enabled = True
+        with mock.patch("vrc.GRAPH", graph):
+            prefetcher.note(["a", "b"])
+            prefetcher.start()
+            assert prefetcher.thread
+            prefetcher.thread.join()
+            self.assertEqual(prefetcher.cache["closure", "a", False], {"a", "b", "c"})
+            self.assertEqual(prefetcher.cache["callers", "b", False], ["a"])
+            self.assertEqual(prefetcher.closure(["a", "b"], callers=True), {"a", "b"})
+            self.assertEqual(prefetcher.metrics(["b"], closure=True),
+                             {"b": vrc.NodeMetrics(callers=1, callees=1, all_callers=1, all_callees=1)})
+
+            # Changing the graph invalidates the cache
+            graph.add_edge("c", "d", "call")
+            self.assertEqual(prefetcher.closure(["a"], callers=False), {"a", "b", "c", "d"})
+            self.assertNotIn(("closure", "b", False), prefetcher.cache)
+
+    def test_prefetcher_cancel(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(*[(f"f{i}", [f"f{i + 1}"]) for i in range(5000)])), ignore)
+        prefetcher = vrc.Prefetcher()
+        prefetcher.enabled = True
+        prefetcher.cancelled.set()
+        with mock.patch("vrc.GRAPH", graph):
+            self.assertIsNone(prefetcher._closure(graph, "f0", False))
+            prefetcher.cancelled.clear()
+            self.assertEqual(len(prefetcher._closure(graph, "f0", False) or ()), 5001)
+
+    def test_address_taken(self):
+        graph = vrc.Graph()
+        graph.add_node("a", file="a.o")
+        graph.add_node("b", file="b.o")
+        graph.add_node("f")
+        graph.add_node("g")
+        graph.add_edge("a", "f", "ref")
+        graph.add_edge("b", "f", "ref")
+        graph.add_edge("a", "g", "call")
+        graph.add_edge("a", "g", "ref")
+        graph.add_edge("b", "g", "call")
+        graph.add_edge("b", "var", "ref")
+        self.assertEqual(graph.address_taken(), {"f": ({"a.o", "b.o"}, False), "g": ({"a.o"}, True)})
+        self.assertIn("var", graph.address_taken(external_ok=True))
+        self.assertEqual(graph.nodes["a"]["g"], "call")
+
+    def test_remark_function_name(self):
+        self.assertEqual(vrc.remark_function_name("int S::get() const/3"), "S::get")
+        self.assertEqual(vrc.remark_function_name("T tw(T) [with T = int]/6"), "tw")
+        self.assertEqual(vrc.remark_function_name("char* foo(int (*)(int))/2"), "foo")
+        self.assertEqual(vrc.remark_function_name("bool operator<(const A&, const A&)/1"), "operator<")
+        self.assertEqual(vrc.remark_function_name("caller/4"), "caller")
+
+    def test_parse_remarks(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b", "_Z3extv"]), ("b", []), ("c", []))), ignore)
+        self.assertEqual(graph.address_taken(external_ok=True), {})
+        remarks = [
+            "a.c:5:55: optimized:  Inlining c/0 into a/2.\n",
+            "a.c:5:56: missed:   will not early inline: a/2->b/1, call is cold\n",
+            "a.c:5:57: missed:   not inlinable: a/2 -> b/1, --param max-inline-insns-auto limit reached\n",
+            "a.c:5:58: missed:   not inlinable: int a()/2 -> int ext()/7, function body not available\n",
+        ]
+        graph.parse_remarks("a.inline", iter(remarks), ignore)
+        self.assertEqual(graph.edge_inline("a", "b"), "not-inlined: --param max-inline-insns-auto limit reached")
+        self.assertEqual(graph.edge_inline("a", "_Z3extv"), "not-inlined: function body not available")
+        self.assertEqual(graph.edge_inline("a", "c"), "inlined")
+        self.assertEqual(list(graph.inlined_callees("a")), ["c"])
+        self.assertIsNone(graph.edge_inline("b", "c"))
+
+    def test_callgrind(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b", "b"]), ("b", ["c"]))), ignore)
+        f = io.StringIO()
+        with mock.patch("vrc.GRAPH", graph):
+            vrc.OutputCommand.write_callgrind(f, external_ok=True)
+        lines = f.getvalue().splitlines()
+        self.assertIn("events: Insns", lines)
+        body = lines[lines.index("fn=(1) a"):]
+        self.assertEqual(body[:5], ["fn=(1) a", "0 2", "cfn=(2) b", "calls=2 0", "0 1"])
+        self.assertIn("fn=(2)", body)
+        self.assertIn("cfl=(2) (external)", body)
+        self.assertEqual(lines[-1], "totals: 3")
+
+    def test_callgrind_inclusive(self):
+        """The cost of a call is the inclusive cost of the callee."""
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b", "z"]), ("b", ["c", "c"]), ("c", ["d", "d", "d"]),
+                                                 ("z", []))), ignore)
+        # The profile says that a never calls z
+        graph.nodes["a"].counts = {"b": 5, "z": 0}
+        f = io.StringIO()
+        with mock.patch("vrc.GRAPH", graph):
+            vrc.OutputCommand.write_callgrind(f, external_ok=True)
+
+        # Sum the self cost and the call costs of each function, as KCachegrind does
+        names: dict[str, str] = {}
+        inclusive: dict[str, int] = {}
+        fn = ""
+        for line in f.getvalue().splitlines():
+            if line.startswith(("fn=", "cfn=")):
+                id, _, name = line.split("=", 1)[1].partition(" ")
+                names.setdefault(id, name)
+                if line.startswith("fn="):
+                    fn = names[id]
+                    inclusive[fn] = 0
+            elif line.startswith("0 "):
+                inclusive[fn] += int(line.split()[1])
+        self.assertEqual(inclusive, {"a": 2 + 2 + 3, "b": 2 + 3, "c": 3, "z": 0})
+        self.assertIn("calls=5 0", f.getvalue())
+        self.assertNotIn("calls=0", f.getvalue())
+
+    def test_condensation(self):
+        graph = vrc.Graph()
+        for name in "abcde":
+            graph.add_node(name)
+        for caller, callee in [("a", "b"), ("b", "c"), ("c", "b"), ("c", "d"), ("a", "e")]:
+            graph.add_edge(caller, callee, "call")
+        graph.add_edge("e", "f", "ref")
+        cond = graph.condensation()
+        self.assertEqual(cond.scc_of["b"], cond.scc_of["c"])
+        self.assertEqual(len(cond.members), 5)
+        for scc, succ in enumerate(cond.succ):
+            self.assertTrue(all(s < scc for s in succ))
+        self.assertEqual([cond.closure_size(x) for x in "abcdef"], [5, 3, 3, 1, 1, 1])
+        self.assertIs(graph.condensation(), cond)
+        graph.add_edge("d", "a", "call")
+        self.assertEqual(graph.condensation().closure_size("d"), 5)
+
+    def check_condensation(self, graph, cond):
+        fresh = vrc.Condensation(graph)
+        names = list(graph.nodes)
+        self.assertEqual({frozenset(m) for m in cond.members if m},
+                         {frozenset(m) for m in fresh.members})
+        for scc, members in enumerate(cond.members):
+            self.assertTrue(all(cond.scc_of[x] == scc for x in members))
+            self.assertEqual(cond.mask[scc], sum(1 << cond.bit[x] for x in members))
+            self.assertTrue(all(cond.ord[s] < cond.ord[scc] for s in cond.succ[scc]))
+            self.assertTrue(all(scc in cond.succ[p] for p in cond.pred[scc]))
+        cached = {x: cond.sizes[cond.scc_of[x]] for x in names if cond.scc_of[x] in cond.sizes}
+        self.assertEqual(cached, {x: fresh.closure_size(x) for x in cached})
+        self.assertEqual([cond.closure_size(x) for x in names], [fresh.closure_size(x) for x in names])
+
+    def test_incremental_condensation(self):
+        graph = vrc.Graph()
+        for name in "abcd":
+            graph.add_node(name)
+        graph.add_edge("a", "b", "call")
+        graph.add_edge("c", "d", "call")
+        cond = graph.condensation()
+        self.assertEqual(cond.closure_size("a"), 2)
+        # Reorder, then close a cycle and open it again
+        graph.add_edge("b", "c", "call")
+        self.assertEqual(cond.closure_size("a"), 4)
+        graph.add_edge("d", "a", "call")
+        self.assertEqual(len({cond.scc_of[x] for x in "abcd"}), 1)
+        self.assertNotIn(cond.scc_of["a"], cond.sizes)
+        graph.add_node("e")
+        graph.add_edge("e", "a", "call")
+        self.assertEqual(cond.closure_size("e"), 5)
+        graph.remove_edge("b", "c")
+        self.assertEqual(len({cond.scc_of[x] for x in "abcd"}), 4)
+        self.assertEqual([cond.closure_size(x) for x in "abcde"], [2, 1, 4, 3, 3])
+        self.assertIs(graph.condensation(), cond)
+        self.check_condensation(graph, cond)
+
+    def test_condensation_bulk_load(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(*[(f"f{i}", [f"f{i + 1}"]) for i in range(100)])), ignore)
+        cond = graph.condensation()
+        self.assertEqual(cond.closure_size("f0"), 101)
+        # A small load updates the condensation at the end...
+        graph.parse("b.o.253r.expand", iter(dump(("g", ["f0"]), ("f100", ["g"]))), ignore)
+        self.assertIs(graph.condensation(), cond)
+        self.check_condensation(graph, cond)
+        self.assertEqual(cond.closure_size("f50"), 102)
+        # ... and a large one drops it
+        records = b"".join(vrc.extract_records("c.o.253r.expand", iter(dump(
+            *[(f"h{i}", [f"h{i + 1}", "f0"]) for i in range(10)])), False)).decode()
+        graph.parse_records(io.StringIO(records), ignore)
+        self.assertIsNot(graph.condensation(), cond)
+        self.assertEqual(graph.condensation().closure_size("h0"), 113)
+
+    def test_incremental_condensation_random(self):
+        rnd = random.Random(1)
+        graph = vrc.Graph()
+        for i in range(30):
+            graph.add_node(f"f{i}")
+        cond = graph.condensation()
+        edges = []
+        for step in range(300):
+            if edges and rnd.random() < 0.3:
+                graph.remove_edge(*edges.pop(rnd.randrange(len(edges))))
+            else:
+                caller, callee = f"f{rnd.randrange(30)}", f"f{rnd.randrange(32)}"
+                graph.add_edge(caller, callee, rnd.choice(["call", "call", "ref"]))
+                edges.append((caller, callee))
+            if step % 10 == 0:
+                cond.closure_size(f"f{rnd.randrange(30)}")
+            self.check_condensation(graph, cond)
+
+    def test_elf_functions(self):
+        # ELF header, a null section, .symtab, .strtab (also used for the
+        # section names) and .text.hot.f
+        strtab = b"\0f\0g\0d\0u\0.text.hot.f\0"
+        symbols = [struct.pack("<IBBHQQ", 0, 0, 0, 0, 0, 0),
+                   struct.pack("<IBBHQQ", 1, 0x12, 0, 3, 0, 46),    # global function
+                   struct.pack("<IBBHQQ", 3, 0x02, 0, 1, 48, 17),   # local function
+                   struct.pack("<IBBHQQ", 5, 0x11, 0, 1, 0, 8),     # global object
+                   struct.pack("<IBBHQQ", 7, 0x10, 0, 0, 0, 0)]     # undefined
+        symtab = b"".join(symbols)
+        shoff = 64 + len(symtab) + len(strtab)
+        header = b"\x7fELF\x02\x01\x01" + bytes(9) + \
+            struct.pack("<HHIQQQIHHHHHH", 1, 62, 1, 0, 0, shoff, 0, 64, 0, 0, 64, 4, 2)
+        sections = [bytes(64),
+                    struct.pack("<IIQQQQIIQQ", 0, 2, 0, 0, 64, len(symtab), 2, 1, 8, 24),
+                    struct.pack("<IIQQQQIIQQ", 0, 3, 0, 0, 64 + len(symtab), len(strtab), 0, 0, 1, 0),
+                    struct.pack("<IIQQQQIIQQ", 9, 1, 6, 0, 0, 0, 0, 0, 16, 0)]
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = os.path.join(tmp, "a.o")
+            with open(fn, "wb") as f:
+                f.write(header + symtab + strtab + b"".join(sections))
+            self.assertEqual(vrc.elf_functions(fn), {"f": vrc.ElfSymbol(46, vrc.STB_GLOBAL),
+                                                     "g": vrc.ElfSymbol(17, vrc.STB_LOCAL)})
+            self.assertEqual(vrc.elf_functions(os.path.join(tmp, "missing.o")), {})
+            self.assertEqual(vrc.elf_undefined(fn), {"u"})
+            self.assertEqual(vrc.elf_function_sections(fn), {"f": ".text.hot.f", "g": ""})
+
+            graph = vrc.Graph()
+            graph.parse("a.o.253r.expand", iter(dump(("f", ["g"]), ("g", []), ("h", []))), ignore)
+            self.assertEqual(graph.read_code_sizes("a.o.253r.expand", fn), 2)
+            self.assertEqual(graph.code_size("f"), 46)
+            self.assertEqual(graph.code_size("h"), 0)
+
+            # g is not in a section of its own, and h is not in the object
+            lines = dump(("main", ["f", "g", "h"]), ("f", []), ("g", []), ("h", []))
+            mark(lines, "main", "executed once")
+            mark(lines, "g", "unlikely executed")
+            mark(lines, "h", "hot")
+            graph = vrc.Graph()
+            graph.parse(os.path.join(tmp, "a.o.253r.expand"), iter(lines), ignore)
+            with mock.patch("vrc.GRAPH", graph):
+                self.assertEqual(vrc.function_sections(["f", "g", "h", "main", "x"]),
+                                 {"f": ".text.hot.f", "g": ".text.unlikely.g", "h": ".text.hot.h",
+                                  "main": ".text.startup.main", "x": ".text.x"})
+
+    def test_function_frequency(self):
+        lines = dump(("work", ["die"]), ("die", []), ("main", ["work"]))
+        mark(lines, "work", "hot")
+        mark(lines, "die", "unlikely executed")
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(lines), ignore)
+        self.assertEqual(sorted(graph.nodes), ["die", "main", "work"])
+        self.assertEqual(graph.nodes["work"].frequency, "hot")
+        self.assertEqual(graph.nodes["die"].frequency, "unlikely executed")
+        self.assertIsNone(graph.nodes["main"].frequency)
+
+        records = b"".join(vrc.extract_records("a.o.253r.expand", iter(lines), False)).decode()
+        self.assertIn("F\ta.o.253r.expand\twork\twork\t1\thot\n", records)
+        copy = vrc.Graph()
+        copy.parse_records(io.StringIO(records), ignore)
+        self.assertEqual(copy.nodes["die"].frequency, "unlikely executed")
+
+    def test_cold_candidates(self):
+        lines = dump(("die", ["report"]), ("report", ["log"]), ("log", []),
+                     ("handler", ["retry", "log"]), ("retry", ["handler"]),
+                     ("work", ["die", "shared"]), ("shared", []), ("main", ["work", "handler", "cleanup"]),
+                     ("cleanup", ["shared"]), ("dead1", ["dead2"]), ("dead2", ["dead1"]))
+        mark(lines, "die", "unlikely executed")
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(lines), ignore)
+        # log is also called by handler, which is not cold yet
+        self.assertEqual(graph.cold_candidates([]), {"report"})
+        # retry is only called by handler, even though it calls it back
+        self.assertEqual(graph.cold_candidates(["handler"]), {"handler", "retry", "report", "log"})
+
+    def test_internalize_candidates(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("api", ["helper", "helper", "shared", "st"]), ("helper", []),
+                                                 ("st", ["helper"]), ("shared", []), ("unused", []),
+                                                 ("inl", ["helper2"]), ("helper2", []))), ignore)
+        graph.parse("b.o.253r.expand", iter(dump(("other", ["shared"]), ("inl", []))), ignore)
+        graph.nodes["st"].binding = vrc.STB_LOCAL
+        self.assertEqual(graph.internalize_candidates(), [("helper", 3)])
+        graph.nodes["st"].binding = vrc.STB_GLOBAL
+        self.assertEqual(graph.internalize_candidates(), [("helper", 3), ("st", 1)])
+        # st is in a table of function pointers in b.o; a.o's own uses do not count
+        self.assertEqual(graph.internalize_candidates({"st": {"b.o.253r.expand"}, "helper": {"a.o.253r.expand"}}),
+                         [("helper", 3)])
+
+    def test_footprints(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(("a", ["b", "c"]), ("b", ["c"]), ("c", ["b"]),
+                                                 ("d", ["c", "e"]), ("e", []))), ignore)
+        for name, size in {"a": 10, "b": 20, "c": 30, "d": 40, "e": 50}.items():
+            graph.nodes[name].code_bytes = size
+        with mock.patch("vrc.GRAPH", graph):
+            result = vrc.footprints(["a", "d", "b"], 2)
+        self.assertEqual(result["a"], vrc.Footprint(60, 3, 10, [(30, "c"), (20, "b")]))
+        self.assertEqual(result["d"], vrc.Footprint(140, 4, 90, [(50, "e"), (40, "d")]))
+        self.assertEqual(result["b"], vrc.Footprint(50, 2, 0, [(30, "c"), (20, "b")]))
+        # b and c are in the same component, so neither has unique functions
+        with mock.patch("vrc.GRAPH", graph):
+            result = vrc.footprints(["b", "c", "e"], 0)
+        self.assertEqual(result["c"], vrc.Footprint(50, 2, 0, []))
+        self.assertEqual(result["e"], vrc.Footprint(50, 1, 50, []))
+
+        planes = vrc.bit_planes([5, 0, 12, 3])
+        self.assertEqual(vrc.weighted_count(0b1101, planes), 20)
+        self.assertEqual(vrc.weighted_count(0b0010, planes), 0)
+        self.assertEqual(vrc.bit_planes([]), [])
+
+    def test_heavy_path(self):
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(dump(
+            ("main", ["small", "big", "big", "mid"]),
+            ("big", ["x", "y"]), ("mid", ["y"]), ("small", []), ("x", ["y"]), ("y", []))), ignore)
+        with mock.patch("vrc.GRAPH", graph):
+            self.assertEqual(vrc.heavy_path("main", 2, 5, 100, False),
+                             [("main", "big", 6, 1), ("main", "mid", 2, 1), ("big", "x", 2, 2),
+                              ("big", "y", 1, 2)])
+            self.assertEqual(len(vrc.heavy_path("main", 2, 1, 100, False)), 2)
+            self.assertEqual(len(vrc.heavy_path("main", 2, 5, 3, False)), 3)
+
+    def test_heavy_path_assembler_name(self):
+        lines = dump(("root", ["leaf"]), ("leaf", []))
+        lines[0] = lines[0].replace("(root,", "(_Z4rooti,")
+        graph = vrc.Graph()
+        graph.parse("a.o.253r.expand", iter(lines), ignore)
+        args = vrc.PARSER.parse_args(["heavy-path", "_Z4rooti"])
+        with mock.patch("vrc.GRAPH", graph), mock.patch("sys.stdout", new_callable=io.StringIO) as stdout:
+            args.cmdclass().run(args)
+        self.assertEqual(stdout.getvalue(), "root\n  leaf (1)\n")
@@ -10,44 +10,368 @@
 # (at your option) any later version.
 
 import argparse
-from collections import defaultdict
+from collections import Counter, defaultdict, deque
+import concurrent.futures
+import contextlib
+import copy
 import dataclasses
 import glob
+import hashlib
+import heapq
 import io
+import itertools
 import json
+import math
+import mmap
 import os
+import pickle
 import re
 import readline
 import shlex
+import struct
 import subprocess
 import sys
+import tempfile
+import threading
+import time
 import typing
 
 
+T = typing.TypeVar("T")
+R = typing.TypeVar("R")
+
+
+# Number of bits set in a non-negative integer.  int.bit_count() is
+# only available in Python 3.10 and newer.
+popcount: typing.Callable[[int], int] = getattr(int, "bit_count", lambda bits: bin(bits).count("1"))
+
+
+def free_threaded() -> bool:
+    """Return True if running on a free-threaded (no GIL) Python."""
+    is_gil_enabled = getattr(sys, "_is_gil_enabled", None)
+    return is_gil_enabled is not None and not is_gil_enabled()
+
+
+# Number of threads used for parallel queries.  Without free threading
+# they would only add overhead, so everything runs serially.
+JOBS = (os.cpu_count() or 1) if free_threaded() else 1
+
+_POOL: typing.Optional[concurrent.futures.ThreadPoolExecutor] = None
+_POOL_LOCK = threading.Lock()
+
+
+def parallel_map(fn: typing.Callable[[T], R], items: typing.Sequence[T]) -> list[R]:
+    """Apply fn to each of the items, using a thread pool if JOBS > 1."""
+    global _POOL
+    if JOBS <= 1 or len(items) <= 1:
+        return [fn(x) for x in items]
+    with _POOL_LOCK:
+        if _POOL is None:
+            _POOL = concurrent.futures.ThreadPoolExecutor(JOBS, thread_name_prefix="vrc")
+    return list(_POOL.map(fn, items))
+
+
+def chunks(items: typing.Sequence[T], n: int) -> list[typing.Sequence[T]]:
+    """Split items into at most n slices of roughly the same size."""
+    size = max(1, -(-len(items) // max(1, n)))
+    return [items[i:i + size] for i in range(0, len(items), size)]
+
+
+class RWLock:
+    """A readers-writer lock.  Any number of threads can hold it for reading
+       ("with lock.read()"); a writer ("with lock.write()") excludes all other
+       threads, but it can take the lock again for either reading or writing.
+       Once a writer is waiting, new readers wait for it, so that a stream
+       of queries cannot starve it; threads that already hold the lock for
+       reading can take it again.  A thread that holds the lock for reading
+       must not ask for writing, which would wait forever for itself, so
+       RuntimeError is raised instead.  The generation counter is
+       incremented whenever a writer is done."""
+
+    class _Reader:
+        def __init__(self, lock: "RWLock") -> None:
+            self.lock = lock
+
+        def __enter__(self) -> None:
+            lock = self.lock
+            reads = getattr(lock._local, "reads", 0)
+            with lock._mutex:
+                if not reads and not lock._depth:
+                    while lock._waiting:
+                        lock._cond.wait()
+                lock._readers += 1
+            lock._local.reads = reads + 1
+
+        def __exit__(self, *args: typing.Any) -> None:
+            lock = self.lock
+            lock._local.reads -= 1
+            with lock._mutex:
+                lock._readers -= 1
+                if not lock._readers:
+                    lock._cond.notify_all()
+
+    class _Writer:
+        def __init__(self, lock: "RWLock") -> None:
+            self.lock = lock
+
+        def __enter__(self) -> None:
+            lock = self.lock
+            lock._mutex.acquire()
+            if not lock._depth:
+                if getattr(lock._local, "reads", 0):
+                    lock._mutex.release()
+                    raise RuntimeError("lock taken for writing by a thread that holds it for reading")
+                lock._waiting += 1
+                while lock._readers:
+                    lock._cond.wait()
+                lock._waiting -= 1
+            lock._depth += 1
+
+        def __exit__(self, *args: typing.Any) -> None:
+            lock = self.lock
+            lock._depth -= 1
+            lock.generation += 1
+            if not lock._depth:
+                lock._cond.notify_all()
+            lock._mutex.release()
+
+    def __init__(self) -> None:
+        # Writers hold _mutex for the whole critical section, readers
+        # only while updating the count.
+        self._mutex = threading.RLock()
+        self._cond = threading.Condition(self._mutex)
+        self._local = threading.local()     # Read depth of each thread
+        self._readers = 0
+        self._waiting = 0                   # Writers waiting for the readers
+        self._depth = 0
+        self.generation = 0
+        self._reader = RWLock._Reader(self)
+        self._writer = RWLock._Writer(self)
+
+    def read(self) -> typing.ContextManager[None]:
+        return self._reader
+
+    def write(self) -> typing.ContextManager[None]:
+        return self._writer
+
+
+# Used to estimate code size from the number of RTL insns
+AVG_INSN_BYTES = 4
+
+
 @dataclasses.dataclass
 class Node:
     name: str
     callers: set[str]
     callees: dict[str, str]
+    calls: dict[str, int]   # Number of call sites for each callee
+    counts: dict[str, int]  # Profile count of the calls, if available
     username: typing.Optional[str] = None
+    file: typing.Optional[str] = None
     external: bool = True
+    size: int = 0           # Number of RTL insns in the first definition
+    copies: int = 0         # Number of dumps that define the function
+    total_size: int = 0     # Number of RTL insns in all the copies
+    # Callees that are both called and referenced, if any
+    called_and_referenced: typing.Optional[set[str]] = None
+    # "inlined" or "not-inlined: REASON" for callees with inlining remarks
+    inline: typing.Optional[dict[str, str]] = None
+    code_bytes: typing.Optional[int] = None   # st_size from the object file
+    binding: typing.Optional[int] = None      # STB_* from the object file
+    # "hot", "unlikely executed" or "executed once" if GCC says so
+    frequency: typing.Optional[str] = None
 
     def __init__(self, name):
         super().__init__()
         self.name = name
         self.callers = set()
         self.callees = dict()
+        self.calls = dict()
+        self.counts = dict()
 
     def __getitem__(self, callee: str) -> str:
         return self.callees[callee]
 
     def __setitem__(self, callee: str, type: str):
+        old = self.callees.get(callee)
+        if old is not None and old != type:
+            if self.called_and_referenced is None:
+                self.called_and_referenced = set()
+            self.called_and_referenced.add(callee)
         # A "ref" edge does not override a "call" edge
-        if type == "call" or callee not in self.callees:
+        if type == "call" or old is None:
             self.callees[callee] = type
 
+    def add_call_sites(self, callee: str, calls: int, count: typing.Optional[int]) -> None:
+        self.calls[callee] = self.calls.get(callee, 0) + calls
+        if count is not None:
+            self.counts[callee] = self.counts.get(callee, 0) + count
+
+
+@dataclasses.dataclass
+class NodeMetrics:
+    callers: int
+    callees: int
+    all_callers: typing.Optional[int] = None
+    all_callees: typing.Optional[int] = None
+
+
+DumpRecord = tuple[str, str, typing.Any]
+
+
+def scan_dump(lines: typing.Iterable[str],
+              want_edges: typing.Callable[[str], bool]) -> typing.Iterator[DumpRecord]:
+    """Scan an RTL dump, either in the full or in the slim format
+       (-fdump-rtl-expand-slim), and yield one tuple for each event:
+
+       ("function", NAME, USERNAME) at the start of each function
+       ("frequency", NAME, FREQUENCY) after it, if GCC marked the function
+           as "hot", "unlikely executed" or "executed once"
+       ("edge", CALLEE, "call"|"ref") for each symbol reference
+       ("call_site", CALLEE, COUNT) for each call insn, with its profile
+           count or None
+       ("end", NAME, SIZE) at the end of each function, with its size in insns
+
+       Edges and call sites are only scanned if want_edges(NAME) is true;
+       it is called before the function's record is yielded.  The scanner
+       keeps no state across functions."""
+    RE_FUNC1 = re.compile(r"^;; Function (\S+)\s*$")
+    RE_FUNC2 = re.compile(r"^;; Function (.*)\s+\((\S+), funcdef_no=[^)]*\)(?: \(([a-z ]+)\))?\s*$")
+    RE_FUNC3 = re.compile(r"^;; Function (.*)\s+\((\S+)(,.*)?\).*$")
+    RE_SYMBOL_REF = re.compile(r'\(symbol_ref [^(]* \( "([^"]*)"', flags=re.X)
+    # Slim insns are "   12: body", but notes, barriers, labels and
+    # debug insns are not counted, just like in the full format
+    RE_SLIM_INSN = re.compile(r"^\s*\d+: (?!NOTE_INSN_|barrier|debug |L\d+:)")
+    RE_SLIM_SYMBOL_REF = re.compile(r"`([^']*)'")
+    RE_BB_COUNT = re.compile(r"^;; basic block \d+, loop depth \d+, count (\d+)")
+    INSNS = ("(insn", "(call_insn", "(jump_insn", "(jump_table_data")
+    curfunc = None
+    scan = False
+    full_rtl = False
+    slim = False
+    size = 0
+    count: typing.Optional[int] = None
+
+    for line in lines:
+        if line.startswith(";; Function "):
+            frequency = None
+            m = RE_FUNC1.search(line)
+            if m:
+                name, username = m.group(1), None
+            else:
+                m = RE_FUNC2.search(line)
+                if m:
+                    frequency = m.group(3)
+                else:
+                    m = RE_FUNC3.search(line)
+                    if not m:
+                        continue
+                name, username = m.group(2), m.group(1)
+
+            if curfunc:
+                yield ("end", curfunc, size)
+            curfunc = name
+            size = 0
+            count = None
+            full_rtl = False
+            scan = want_edges(name)
+            yield ("function", name, username)
+            if frequency:
+                yield ("frequency", name, frequency)
+            continue
+
+        if not curfunc:
+            continue
+        # Insns are printed twice with -fdump-rtl-expand-*-details,
+        # only count them once
+        if full_rtl:
+            if line.startswith(INSNS):
+                size += 1
+            elif line.startswith(";; basic block "):
+                # The count is only printed with -fprofile-use and
+                # -fdump-rtl-expand-blocks-details, see dump_option()
+                m = RE_BB_COUNT.search(line)
+                count = int(m.group(1)) if m else None
+            elif slim:
+                # In the full format every insn starts with "(", so after
+                # the first one only the prefixes above need to be checked
+                if line.startswith("("):
+                    slim = False
+                elif RE_SLIM_INSN.match(line):
+                    size += 1
+        elif line.startswith(";; Full RTL generated"):
+            full_rtl = True
+            slim = True
+        if scan:
+            if "(symbol_ref" in line:
+                m = RE_SYMBOL_REF.search(line)
+                is_call = "(call" in line
+            elif "`" in line:
+                m = RE_SLIM_SYMBOL_REF.search(line)
+                is_call = "call [" in line
+            else:
+                continue
+            if m:
+                # The REG_CALL_DECL note repeats the callee of a call insn
+                call_decl = not is_call and "REG_CALL_DECL" in line
+                yield ("edge", m.group(1), "call" if is_call or call_decl else "ref")
+                if full_rtl and is_call:
+                    yield ("call_site", m.group(1), count)
+
+    if curfunc:
+        yield ("end", curfunc, size)
+
+
+def remark_function_name(s: str) -> str:
+    """Guess the name of a function from the way inlining remarks print it,
+       for example "int S::get() const/3" or "T tw(T) [with T = int]/6"."""
+    s = re.sub(r"/\d+$", "", s.strip())
+    s = re.sub(r" \[with .*\]$", "", s)
+    s = re.sub(r"(\s+(const|volatile|&|&&|noexcept))+$", "", s)
+    if s.endswith(")"):
+        # Remove the parameter list...
+        depth = 0
+        for i in range(len(s) - 1, -1, -1):
+            depth += {")": 1, "(": -1}.get(s[i], 0)
+            if depth == 0:
+                s = s[:i]
+                break
+    # ... and the return type
+    m = re.search(r"\S*operator\b.*$", s)
+    if m:
+        return m.group(0)
+    depth = 0
+    for i in range(len(s) - 1, -1, -1):
+        depth += {">": 1, "<": -1, ")": 1, "(": -1}.get(s[i], 0)
+        if depth == 0 and s[i] == " ":
+            s = s[i + 1:]
+            break
+    return s.lstrip("*&")
+
+
+def scan_remarks(lines: typing.Iterable[str]) -> typing.Iterator[tuple[str, str, typing.Optional[str]]]:
+    """Scan the output of -fopt-info-inline-all and yield (CALLER, CALLEE,
+       REASON) for each call site, where REASON is None if the call was
+       inlined.  The early inliner's refusals are not final and are skipped."""
+    RE_INLINED = re.compile(r": optimized:\s+Inlin(?:ing|ed) (.+?) into (.+?)(?: which now has .*|\.)$")
+    RE_NOT_INLINABLE = re.compile(r": missed:\s+not inlinable: (.+?) -> (.+?), (.*)$")
+    for line in lines:
+        if "nlin" not in line:
+            continue
+        m = RE_INLINED.search(line)
+        if m:
+            yield remark_function_name(m.group(2)), remark_function_name(m.group(1)), None
+            continue
+        m = RE_NOT_INLINABLE.search(line)
+        if m:
+            yield remark_function_name(m.group(1)), remark_function_name(m.group(2)), m.group(3).strip()
+
 
 class Graph:
+    """The call graph.  Modifications take self.lock for writing.  Queries
+       do not modify the graph and can run concurrently from many threads;
+       those that run in parallel take self.lock for reading."""
+    lock: RWLock
     nodes: dict[str, Node]
     nodes_by_username: dict[str, Node]
     nodes_by_file: dict[str, list[str]]
@@ -56,47 +380,286 @@ class Graph:
     omitting_callers: set[str]    # Edges directed to these nodes are ignored
     omitting_callees: set[str]    # Edges starting from these nodes are ignored
     filter_default: bool
+    _condensation: typing.Optional["Condensation"]
+    _condensation_lock: threading.Lock
+    # Nodes (callee None) and call edges added during a bulk load
+    _pending: typing.Optional[list[tuple[str, typing.Optional[str]]]]
+
+    # A bulk load that adds more call edges than this fraction of the
+    # nodes drops the condensation, because building it again is cheaper
+    # than updating it one edge at a time
+    BATCH_REBUILD_FRACTION = 1 / 32
 
     def __init__(self):
+        self.lock = RWLock()
         self.nodes = {}
         self.nodes_by_username = {}
-        self.nodes_by_file = defaultdict(lambda: list())
+        self.nodes_by_file = defaultdict(list)
+        self._condensation = None
+        self._condensation_lock = threading.Lock()
+        self._pending = None
 
         self.reset_filter()
 
-    def parse(self, fn: str, lines: typing.Iterator[str], verbose_print) -> None:
-        RE_FUNC1 = re.compile(r"^;; Function (\S+)\s*$")
-        RE_FUNC2 = re.compile(r"^;; Function (.*)\s+\((\S+)(,.*)?\).*$")
-        RE_SYMBOL_REF = re.compile(r'\(symbol_ref [^(]* \( "([^"]*)"', flags=re.X)
-        curfunc = None
-        for line in lines:
-            if line.startswith(";; Function "):
-                m = RE_FUNC1.search(line)
-                if m:
-                    curfunc = m.group(1)
-                    self.add_node(m.group(1), file=fn)
-                    verbose_print(f"{fn}: found function {m.group(1)}")
-                    continue
-                m = RE_FUNC2.search(line)
-                if m:
-                    curfunc = m.group(2)
-                    self.add_node(m.group(2), username=m.group(1), file=fn)
-                    verbose_print(f"{fn}: found function {m.group(1)} ({m.group(2)})")
-                    continue
-            elif curfunc:
-                m = RE_SYMBOL_REF.search(line)
-                if m:
-                    type = "call" if "(call" in line else "ref"
-                    verbose_print(f"{fn}: found {type} edge {curfunc} -> {m.group(1)}")
-                    self.add_edge(curfunc, m.group(1), type)
+    def __getstate__(self) -> dict[str, typing.Any]:
+        state = self.__dict__.copy()
+        del state["lock"]
+        del state["_condensation_lock"]
+        state["_condensation"] = None
+        state["_pending"] = None
+        return state
+
+    def __setstate__(self, state: dict[str, typing.Any]) -> None:
+        self.__dict__.update(state)
+        self._pending = None
+        self._condensation_lock = threading.Lock()
+        self.lock = RWLock()
+
+    def condensation(self) -> "Condensation":
+        """Return the strongly connected components of the call edges.
+           Once computed, they are updated together with the graph."""
+        with self.lock.read():
+            # Readers can get here at the same time, only one builds it
+            with self._condensation_lock:
+                if self._condensation is None:
+                    self._condensation = Condensation(self)
+                return self._condensation
+
+    def save(self, fn: str) -> None:
+        """Write the graph, including the filter, to a file."""
+        with self.lock.read(), open(fn, "wb") as f:
+            pickle.dump(self, f, protocol=pickle.HIGHEST_PROTOCOL)
+
+    @staticmethod
+    def restore(fn: str) -> "Graph":
+        """Read a graph that was written by save().  Only use trusted files."""
+        with open(fn, "rb") as f:
+            graph = pickle.load(f)
+        if not isinstance(graph, Graph):
+            raise ValueError(f"{fn}: not a saved graph")
+        return graph
+
+    def parse(self, fn: str, lines: typing.Iterator[str], verbose_print,
+              local: typing.Collection[str] = (), verify_duplicates: bool = False) -> None:
+        """Parse an RTL dump.  Functions that were already defined by another
+           file, for example inline functions and template instantiations,
+           are only counted and their bodies are skipped.  If verify_duplicates
+           is True, they are scanned anyway and compared with the first
+           definition.
+
+           local lists the static functions of the dump, as returned by
+           local_functions().  If one of them has the name of a function
+           defined by another file, it is not a duplicate; it gets its own
+           node, see _local_names()."""
+        renames = self._local_names(fn, local)
+        duplicate: typing.Optional[Node] = None
+
+        def want_edges(name: str) -> bool:
+            name = renames.get(name, name)
+            return verify_duplicates or name not in self.nodes or self.nodes[name].external
+
+        with self.lock.write(), self._batch():
+            curfunc = ""
+            for record in scan_dump(lines, want_edges):
+                if record[0] == "function":
+                    curfunc, username = renames.get(record[1], record[1]), record[2]
+                    if username:
+                        verbose_print(f"{fn}: found function {username} ({curfunc})")
+                    else:
+                        verbose_print(f"{fn}: found function {curfunc}")
+                    duplicate = None
+                    if curfunc in self.nodes and not self.nodes[curfunc].external:
+                        if verify_duplicates:
+                            duplicate = Node(curfunc)
+                        else:
+                            verbose_print(f"{fn}: skipping duplicate definition of {curfunc}")
+                    else:
+                        if curfunc != record[1]:
+                            username = f"{username or record[1]}@{os.path.basename(object_file(fn))}"
+                        self._add_node(curfunc, username=username, file=fn)
+                elif record[0] == "frequency":
+                    if not self.nodes[curfunc].copies:
+                        self.nodes[curfunc].frequency = record[2]
+                elif record[0] == "edge":
+                    callee, type = renames.get(record[1], record[1]), record[2]
+                    if duplicate is None:
+                        verbose_print(f"{fn}: found {type} edge {curfunc} -> {callee}")
+                        self._add_edge(curfunc, callee, type)
+                    else:
+                        duplicate[callee] = type
+                elif record[0] == "call_site":
+                    callee = renames.get(record[1], record[1])
+                    node = duplicate if duplicate is not None else self.nodes[curfunc]
+                    node.add_call_sites(callee, 1, record[2])
+                else:
+                    self._end_function(fn, curfunc, record[2], duplicate)
+
+    def parse_split(self, fn: str, pool: concurrent.futures.Executor, pieces: int,
+                    verbose_print, local: typing.Collection[str] = (),
+                    verify_duplicates: bool = False) -> None:
+        """Parse a large dump in up to the given number of pieces, which
+           are scanned in parallel by the pool.  The records are merged in
+           file order, so the graph is the same as with parse()."""
+        futures = [pool.submit(extract_range, fn, start, end, local)
+                   for start, end in split_dump(fn, pieces)]
+        for future in futures:
+            self.parse_records(io.StringIO(future.result().decode()), verbose_print,
+                               verify_duplicates=verify_duplicates)
+
+    def parse_records(self, lines: typing.Iterable[str], verbose_print,
+                      verify_duplicates: bool = False) -> None:
+        """Add the functions and edges written by extract_records() in the
+           line format.  Duplicate definitions and static functions are
+           handled as in parse(); the L records take the place of its
+           local argument."""
+        with self.lock.write(), self._batch():
+            # New names of the static functions of each file
+            renames: dict[str, dict[str, str]] = defaultdict(dict)
+            # The function being read, which ends at the next F record
+            current: typing.Optional[tuple[str, str, int]] = None
+            skip = False
+            duplicate: typing.Optional[Node] = None
+            for line in lines:
+                fields = line.rstrip("\n").split("\t")
+                if fields[0] == "L":
+                    renames[fields[1]].update(self._local_names(fields[1], fields[2:]))
+                elif fields[0] == "F":
+                    if current:
+                        self._end_function(*current, duplicate)
+                    fn, username, size = fields[1], fields[3], int(fields[4])
+                    name = renames[fn].get(fields[2], fields[2])
+                    verbose_print(f"{fn}: found function {username or name}")
+                    current = (fn, name, size)
+                    skip = False
+                    duplicate = None
+                    if name in self.nodes and not self.nodes[name].external:
+                        if verify_duplicates:
+                            duplicate = Node(name)
+                        else:
+                            verbose_print(f"{fn}: skipping duplicate definition of {name}")
+                            skip = True
+                    else:
+                        if name != fields[2]:
+                            username = f"{username or fields[2]}@{os.path.basename(object_file(fn))}"
+                        self._add_node(name, username=username or None, file=fn)
+                    node = self.nodes[name]
+                    if not node.copies:
+                        node.frequency = fields[5] if len(fields) > 5 else None
+                elif fields[0] == "E" and not skip and current:
+                    callee, type, calls, count = fields[2:6]
+                    callee = renames[current[0]].get(callee, callee)
+                    both = len(fields) > 6 and fields[6]
+                    if duplicate is not None:
+                        if both:
+                            duplicate[callee] = "ref"
+                        duplicate[callee] = type
+                        node = duplicate
+                    else:
+                        if both:
+                            self._add_edge(current[1], callee, "ref")
+                        self._add_edge(current[1], callee, type)
+                        node = self.nodes[current[1]]
+                    node.add_call_sites(callee, int(calls), int(count) if count else None)
+            if current:
+                self._end_function(*current, duplicate)
 
     def add_external_node(self, name: str) -> None:
-        if name not in self.nodes:
-            self.nodes[name] = Node(name=name)
+        with self.lock.write():
+            self._add_external_node(name)
 
     def add_node(self, name: str, username: typing.Optional[str] = None,
                  file: typing.Optional[str] = None) -> None:
-        self.add_external_node(name)
+        with self.lock.write():
+            self._add_node(name, username, file)
+
+    def add_edge(self, caller: str, callee: str, type: str) -> None:
+        with self.lock.write():
+            self._add_edge(caller, callee, type)
+
+    def remove_edge(self, caller: str, callee: str) -> None:
+        """Remove an edge and what is known about its call sites."""
+        with self.lock.write():
+            n = self.nodes[caller]
+            type = n.callees.pop(callee, None)
+            if type is None:
+                return
+            self.nodes[callee].callers.discard(caller)
+            n.calls.pop(callee, None)
+            n.counts.pop(callee, None)
+            if n.called_and_referenced:
+                n.called_and_referenced.discard(callee)
+            if n.inline:
+                n.inline.pop(callee, None)
+            if type == "call" and self._condensation:
+                self._condensation.remove_edge(caller, callee)
+
+    # The following are called with self.lock held for writing
+
+    def _local_names(self, fn: str, local: typing.Iterable[str]) -> dict[str, str]:
+        """Return the names of the nodes for the static functions of fn whose
+           name is already defined by another file, as NAME@OBJECT, where
+           OBJECT is the base name of the object file."""
+        obj = os.path.basename(object_file(fn))
+        return {name: f"{name}@{obj}" for name in local
+                if name in self.nodes and not self.nodes[name].external and self.nodes[name].file != fn}
+
+    def _end_function(self, fn: str, name: str, size: int, duplicate: typing.Optional[Node]) -> None:
+        """Count a definition of name.  duplicate holds the edges and call
+           sites of a duplicate definition that was scanned; if its callees
+           differ from those of the first definition, print a warning and
+           merge them.  The size is not compared, because it depends on what
+           was inlined in each translation unit."""
+        node = self.nodes[name]
+        if duplicate is not None and duplicate.callees != node.callees:
+            print(f"{fn}: edges of {self.name(name)} differ from the definition in {node.file}",
+                  file=sys.stderr)
+            for callee, type in duplicate.callees.items():
+                new = callee not in node.callees
+                if duplicate.called_and_referenced and callee in duplicate.called_and_referenced:
+                    self._add_edge(name, callee, "ref")
+                self._add_edge(name, callee, type)
+                # Call sites of the other callees were already counted
+                if new and callee in duplicate.calls:
+                    node.add_call_sites(callee, duplicate.calls[callee], duplicate.counts.get(callee))
+        if not node.copies:
+            node.size = size
+        node.copies += 1
+        node.total_size += size
+
+    @contextlib.contextmanager
+    def _batch(self) -> typing.Iterator[None]:
+        """Collect the changes to the condensation during a bulk load, and
+           apply them at the end, unless there are so many of them that
+           the condensation is better built again when needed."""
+        if self._condensation is None or self._pending is not None:
+            yield
+            return
+        self._pending = []
+        try:
+            yield
+        finally:
+            pending, self._pending = self._pending, None
+            edges = sum(1 for _, callee in pending if callee is not None)
+            if edges > len(self.nodes) * self.BATCH_REBUILD_FRACTION:
+                self._condensation = None
+            else:
+                for caller, callee in pending:
+                    if callee is None:
+                        self._condensation.add_node(caller)
+                    else:
+                        self._condensation.add_edge(caller, callee)
+
+    def _add_external_node(self, name: str) -> None:
+        if name not in self.nodes:
+            self.nodes[name] = Node(name=name)
+            if self._pending is not None:
+                self._pending.append((name, None))
+            elif self._condensation:
+                self._condensation.add_node(name)
+
+    def _add_node(self, name: str, username: typing.Optional[str] = None,
+                  file: typing.Optional[str] = None) -> None:
+        self._add_external_node(name)
         if self.nodes[name].external:
             # This is now a defined node.  It might have a username and a file
             self.nodes[name].external = False
@@ -104,13 +667,192 @@ class Graph:
                 self.nodes[name].username = username
                 self.nodes_by_username[username] = self.nodes[name]
             if file:
+                self.nodes[name].file = file
                 self.nodes_by_file[file].append(name)
 
-    def add_edge(self, caller: str, callee: str, type: str) -> None:
+    def _add_edge(self, caller: str, callee: str, type: str) -> None:
         # The caller must exist, but the callee could be external.
-        self.add_external_node(callee)
+        self._add_external_node(callee)
+        old = self.nodes[caller].callees.get(callee)
         self.nodes[caller][callee] = type
         self.nodes[callee].callers.add(caller)
+        if self._condensation and type == "call" and old != "call":
+            if self._pending is not None:
+                self._pending.append((caller, callee))
+            else:
+                self._condensation.add_edge(caller, callee)
+
+    def _add_call_site(self, caller: str, callee: str, count: typing.Optional[int]) -> None:
+        self.nodes[caller].add_call_sites(callee, 1, count)
+
+    def parse_remarks(self, fn: str, lines: typing.Iterable[str], verbose_print) -> None:
+        """Attach inlining remarks from -fopt-info-inline-all to the edges.
+           A call site that was not inlined wins over others that were."""
+        with self.lock.write():
+            for caller, callee, reason in scan_remarks(lines):
+                caller_node = self._get_node(caller)
+                callee_node = self._get_node(callee)
+                if caller_node and not callee_node:
+                    callee_node = self._find_callee(caller_node, callee)
+                if not caller_node or not callee_node:
+                    verbose_print(f"{fn}: unknown function in remark for {caller} -> {callee}")
+                    continue
+                if caller_node.inline is None:
+                    caller_node.inline = {}
+                old = caller_node.inline.get(callee_node.name)
+                if reason is not None:
+                    if not old or old == "inlined":
+                        caller_node.inline[callee_node.name] = f"not-inlined: {reason}"
+                elif not old:
+                    caller_node.inline[callee_node.name] = "inlined"
+
+    def _find_callee(self, caller_node: Node, name: str) -> typing.Optional[Node]:
+        # External functions have no username.  Look for the identifier,
+        # as it appears in a mangled C++ name, among the caller's callees
+        ident = name.split("::")[-1]
+        mangled = f"{len(ident)}{ident}"
+        found = [callee for callee in caller_node.callees if callee == ident or mangled in callee]
+        return self.nodes[found[0]] if len(found) == 1 else None
+
+    def edge_inline(self, caller: str, callee: str) -> typing.Optional[str]:
+        """Return "inlined", "not-inlined: REASON" or None if there are no remarks."""
+        caller_node = self._get_node(caller)
+        callee_node = self._get_node(callee)
+        if not caller_node or not callee_node or not caller_node.inline:
+            return None
+        return caller_node.inline.get(callee_node.name)
+
+    def inlined_callees(self, caller: str) -> typing.Iterator[str]:
+        """Return the callees that were inlined in caller, and are thus not edges of the graph."""
+        n = self._get_node(caller)
+        if not n or not n.inline:
+            return iter([])
+        return (self.name(callee)
+                for callee, status in n.inline.items()
+                if status == "inlined" and callee not in n.callees and self.filter_node(callee, False))
+
+    def edge_weight(self, caller: str, callee: str) -> int:
+        """Estimate how often caller calls callee, from the basic block
+           counts if the dump has them (see dump_option()) or else from the
+           number of call sites."""
+        caller_node = self._get_node(caller)
+        callee_node = self._get_node(callee)
+        if not caller_node or not callee_node:
+            return 0
+        callee = callee_node.name
+        if callee in caller_node.counts:
+            return caller_node.counts[callee]
+        if callee in caller_node.calls:
+            return caller_node.calls[callee]
+        return 1 if caller_node.callees.get(callee) == "call" else 0
+
+    def weighted_calls(self) -> typing.Iterator[tuple[str, str, int]]:
+        """Yield all calls between non-external nodes that pass the filter,
+           with their weight.  Nodes are identified by their assembler name."""
+        for n in self.nodes.values():
+            if not self._filter_node(n, False):
+                continue
+            for callee in n.callees:
+                callee_node = self.nodes[callee]
+                if self._filter_node(callee_node, False) and self._filter_edge(n, callee_node, False):
+                    yield n.name, callee, self.edge_weight(n.name, callee)
+
+    def insns(self, name: str) -> int:
+        """Return the number of RTL insns in a function."""
+        n = self._get_node(name)
+        return n.size if n else 0
+
+    def code_size(self, name: str) -> int:
+        """Return the size in bytes of a function's code, as found in the
+           symbol table of its object file or estimated from its insns."""
+        n = self._get_node(name)
+        if n and n.code_bytes is not None:
+            return n.code_bytes
+        return self.insns(name) * AVG_INSN_BYTES
+
+    def read_code_sizes(self, file: str, obj: str) -> int:
+        """Take the size and the binding of the functions defined by a dump
+           from the symbol table of the corresponding object file.  Return
+           the number of functions that were found."""
+        symbols = elf_functions(obj)
+        # Static functions can have a suffix, see _local_names()
+        suffix = f"@{os.path.basename(object_file(file))}"
+        found = 0
+        with self.lock.write():
+            for name in self.nodes_by_file.get(file, []):
+                symbol = symbols.get(name.removesuffix(suffix))
+                if symbol:
+                    self.nodes[name].code_bytes = symbol.size
+                    self.nodes[name].binding = symbol.binding
+                    found += 1
+        return found
+
+    def cold_candidates(self, handlers: typing.Iterable[str]) -> set[str]:
+        """Return the defined functions that are only used by cold ones.
+           Functions that GCC marked as unlikely executed are cold, and so
+           are the given handlers; functions that GCC marked as hot never
+           are.  The result includes the handlers but not the functions
+           that GCC already considers cold.  The filter is not applied."""
+        with self.lock.read():
+            seeds = {n.name for n in map(self._get_node, handlers) if n}
+            seeds |= {name for name, n in self.nodes.items() if n.frequency == "unlikely executed"}
+
+            # Start by assuming that every function with callers is cold, and
+            # remove those that have a caller which is not, until a fixpoint.
+            # Functions without callers are entry points, which are not cold.
+            cold = {name for name, n in self.nodes.items()
+                    if name in seeds or (n.callers and not n.external and n.frequency != "hot")}
+            worklist = [name for name in self.nodes if name not in cold]
+            while worklist:
+                for callee in self.nodes[worklist.pop()].callees:
+                    if callee in cold and callee not in seeds:
+                        cold.remove(callee)
+                        worklist.append(callee)
+
+            # Cycles with no path from the seeds are left over, drop them
+            result = set()
+            stack = list(seeds)
+            while stack:
+                for callee in self.nodes[stack.pop()].callees:
+                    if callee in cold and callee not in result and callee not in seeds:
+                        result.add(callee)
+                        stack.append(callee)
+            return result | {n.name for n in map(self._get_node, handlers) if n}
+
+    def internalize_candidates(self, undefined: typing.Optional[dict[str, set[str]]] = None
+                               ) -> list[tuple[str, int]]:
+        """Return the functions that are defined once, are not known to be
+           static or weak, and are only called or referenced from their own
+           file, together with their number of call sites, most called first.
+           Functions that are never used are not included, and neither are
+           those used by a function with several definitions, since the other
+           copies can be in other files.  The filter is not applied.
+
+           References from data, such as vtables or tables of function
+           pointers, are not edges.  undefined maps functions to the files
+           whose object files have them as undefined symbols; functions that
+           are undefined in another file are not included either."""
+        undefined = undefined or {}
+        with self.lock.read():
+            result = []
+            for name, n in self.nodes.items():
+                # Names with a dot are local clones such as foo.constprop.0
+                if n.external or n.copies != 1 or not n.callers or name == "main" or "." in name:
+                    continue
+                if n.binding in (STB_LOCAL, STB_WEAK):
+                    continue
+                if any(file != n.file for file in undefined.get(name, ())):
+                    continue
+                calls = 0
+                for caller in n.callers:
+                    c = self.nodes[caller]
+                    if c.file != n.file or c.copies != 1:
+                        break
+                    calls += c.calls.get(name, 0)
+                else:
+                    result.append((name, calls))
+            result.sort(key=lambda x: (-x[1], x[0]))
+            return result
 
     def _get_node(self, name: str) -> typing.Optional[Node]:
         if name in self.nodes_by_username:
@@ -123,29 +865,180 @@ class Graph:
     def has_node(self, name: str) -> bool:
         return bool(self._get_node(name))
 
-    def _visit(self, start: str, targets: typing.Callable[[Node], typing.Iterable[str]]) -> typing.Iterator[str]:
-        visited = set()
+    def has_edge(self, caller: str, callee: str) -> bool:
+        caller_node = self._get_node(caller)
+        callee_node = self._get_node(callee)
+        return bool(caller_node and callee_node and callee_node.name in caller_node.callees)
 
-        def visit(n: Node) -> typing.Iterator[str]:
-            if n.name in visited:
-                return
-            visited.add(n.name)
-            yield n.username or n.name
-            for caller in targets(n):
-                target = self._get_node(caller)
-                if target:
-                    yield from visit(target)
+    def node_file(self, name: str) -> typing.Optional[str]:
+        n = self._get_node(name)
+        return n.file if n else None
+
+    def address_taken(self, external_ok: bool = False) -> dict[str, tuple[set[str], bool]]:
+        """Return the functions that are the target of a "ref" edge, with
+           the files that take their address and whether they are also
+           called directly.  The filter is not applied."""
+        with self.lock.read():
+            refs: dict[str, set[str]] = defaultdict(set)
+            called = set()
+            for n in self.nodes.values():
+                for callee, type in n.callees.items():
+                    if type == "call":
+                        called.add(callee)
+                        if not n.called_and_referenced or callee not in n.called_and_referenced:
+                            continue
+                    refs[callee].add(n.file or "")
+            return {name: (files, name in called)
+                    for name, files in refs.items()
+                    if external_ok or not self.nodes[name].external}
 
+    def _visit(self, start: str, targets: typing.Callable[[Node], typing.Iterable[str]]) -> typing.Iterator[str]:
         n = self._get_node(start)
         if not n:
-            return iter({})
-        yield from visit(n)
+            return
+
+        # Depth-first, preorder.  Use an explicit stack, call chains can
+        # be deeper than the recursion limit.
+        visited = set()
+        stack = [iter([n.name])]
+        while stack:
+            name = next(stack[-1], None)
+            if name is None:
+                stack.pop()
+                continue
+            target = self._get_node(name)
+            if not target or target.name in visited:
+                continue
+            visited.add(target.name)
+            yield target.username or target.name
+            stack.append(iter(targets(target)))
+
+    def bfs(self, roots: typing.Iterable[str],
+            targets: typing.Callable[[Node], typing.Iterable[str]]) -> dict[str, int]:
+        """Level-synchronous breadth-first visit from all of roots at once.
+           Return the distance of each reached node from the nearest root.
+           The nodes in each level are expanded in parallel."""
+        def expand(frontier: typing.Sequence[Node]) -> list[Node]:
+            return [self.nodes[x]
+                    for n in frontier for x in targets(n)
+                    if x not in dist]
+
+        with self.lock.read():
+            dist: dict[str, int] = {}
+            frontier = []
+            for root in roots:
+                n = self._get_node(root)
+                if n and n.name not in dist:
+                    dist[n.name] = 0
+                    frontier.append(n)
+
+            level = 0
+            while frontier:
+                level += 1
+                found = parallel_map(expand, chunks(frontier, JOBS * 4))
+                frontier = []
+                for nodes in found:
+                    for n in nodes:
+                        if n.name not in dist:
+                            dist[n.name] = level
+                            frontier.append(n)
+            return dist
+
+    def closure(self, roots: typing.Iterable[str], callers: bool) -> set[str]:
+        """Return the union of all callers or callees of roots, recursively."""
+        return set(self.bfs(roots, Graph._callers if callers else Graph._callees).keys())
+
+    def closures(self, roots: typing.Sequence[str], callers: bool) -> dict[str, set[str]]:
+        """Return all callers or callees of each root separately, recursively.
+           As in closure(), the keys and the results are assembler names."""
+        targets = Graph._callers if callers else Graph._callees
+
+        def visit(n: Node) -> set[str]:
+            seen = {n.name}
+            stack = [n]
+            while stack:
+                for name in targets(stack.pop()):
+                    if name not in seen:
+                        seen.add(name)
+                        stack.append(self.nodes[name])
+            return seen
+
+        with self.lock.read():
+            nodes = [n for n in map(self._get_node, roots) if n]
+            return dict(zip((n.name for n in nodes), parallel_map(visit, nodes)))
+
+    def metrics(self, names: typing.Sequence[str], closure: bool = False) -> dict[str, NodeMetrics]:
+        """Compute the number of (filtered) callers and callees of each node,
+           and optionally the number of nodes that can reach it or be reached
+           from it."""
+        def compute(names: typing.Sequence[str]) -> list[NodeMetrics]:
+            result = []
+            for name in names:
+                m = NodeMetrics(callers=sum(1 for _ in self.callers(name, False)),
+                                callees=sum(1 for _ in self.callees(name, False, False)))
+                if closure:
+                    m.all_callers = sum(1 for _ in self.all_callers(name)) - 1
+                    m.all_callees = sum(1 for _ in self.all_callees(name)) - 1
+                result.append(m)
+            return result
+
+        with self.lock.read():
+            result = parallel_map(compute, chunks(names, JOBS * 4))
+            return dict(zip(names, (m for chunk in result for m in chunk)))
+
+    def communities(self, names: typing.Iterable[str], ref_ok: bool,
+                    max_iterations: int = 20) -> dict[str, str]:
+        """Group names by label propagation on the (undirected, filtered)
+           subgraph that they induce.  Return the community of each name,
+           identified by one of its members."""
+        with self.lock.read():
+            label = {x: x for x in names}
+            neighbors: dict[str, set[str]] = {x: set() for x in label}
+            for x in label:
+                for y in self.callees(x, False, ref_ok):
+                    if y in label and y != x:
+                        neighbors[x].add(y)
+                        neighbors[y].add(x)
+
+            # Weigh edges by the number of common neighbors, so that labels
+            # spread more easily within densely connected groups
+            weight = {}
+            for x, ns in neighbors.items():
+                for y in ns:
+                    if x < y:
+                        small, big = sorted((ns, neighbors[y]), key=len)
+                        weight[x, y] = weight[y, x] = 1 + sum(1 for z in small if z in big)
+
+            order = sorted(label)
+            for _ in range(max_iterations):
+                changed = False
+                for x in order:
+                    if not neighbors[x]:
+                        continue
+                    count: dict[str, int] = defaultdict(int)
+                    for y in neighbors[x]:
+                        count[label[y]] += weight[x, y]
+                    best = max(count.values())
+                    if count.get(label[x], 0) < best:
+                        label[x] = min(k for k, v in count.items() if v == best)
+                        changed = True
+                if not changed:
+                    break
+            return label
+
+    @staticmethod
+    def _callers(n: Node) -> typing.Iterable[str]:
+        return n.callers
+
+    @staticmethod
+    def _callees(n: Node) -> typing.Iterable[str]:
+        return n.callees.keys()
 
     def all_callers(self, callee: str) -> typing.Iterator[str]:
-        return self._visit(callee, lambda n: n.callers)
+        return self._visit(callee, Graph._callers)
 
     def all_callees(self, caller: str) -> typing.Iterator[str]:
-        return self._visit(caller, lambda n: n.callees.keys())
+        return self._visit(caller, Graph._callees)
 
     def callers(self, callee: str, ref_ok: bool) -> typing.Iterator[str]:
         n = self._get_node(callee)
@@ -170,14 +1063,20 @@ class Graph:
                 if self.filter_node(x, False))
 
     def all_nodes_for_file(self, file: str) -> typing.Iterator[str]:
+        # Do not use self.nodes_by_file[file], readers must not add keys
         return (self.name(x)
-                for x in self.nodes_by_file[file]
+                for x in self.nodes_by_file.get(file, [])
                 if self.filter_node(x, False))
 
     def name(self, x: str) -> str:
         n = self.nodes[x]
         return n.username or x
 
+    def display_name(self, name: str) -> str:
+        """Like name(), but name can also be a username."""
+        n = self._get_node(name)
+        return (n.username or n.name) if n else name
+
     def _filter_node(self, n: Node, external_ok: bool) -> bool:
         if not external_ok and n.external:
             return False
@@ -198,6 +1097,9 @@ class Graph:
         callee_node = self._get_node(callee)
         if not caller_node or not callee_node:
             return False
+        return self._filter_edge(caller_node, callee_node, ref_ok)
+
+    def _filter_edge(self, caller_node: Node, callee_node: Node, ref_ok: bool) -> bool:
         if caller_node.name in self.omitting_callees:
             return False
         if callee_node.name in self.omitting_callers:
@@ -205,12 +1107,13 @@ class Graph:
         return caller_node[callee_node.name] == "call" or (ref_ok and not callee_node.external)
 
     def omit_node(self, name: str) -> None:
-        n = self._get_node(name)
-        name = n.name if n else name
+        with self.lock.write():
+            n = self._get_node(name)
+            name = n.name if n else name
 
-        self.omitted.add(name)
-        if self.keep is not None and name in self.keep:
-            self.keep.remove(name)
+            self.omitted.add(name)
+            if self.keep is not None and name in self.keep:
+                self.keep.remove(name)
 
     def _check_node_visibility(self, name: str) -> None:
         callers = self.callers(name, True)
@@ -224,47 +1127,658 @@ class Graph:
         self.omit_node(name)
 
     def omit_callers(self, name: str) -> None:
-        n = self._get_node(name)
-        name = n.name if n else name
+        with self.lock.write():
+            n = self._get_node(name)
+            name = n.name if n else name
 
-        self.omitting_callers.add(name)
-        self._check_node_visibility(name)
-        if n:
-            for caller in n.callers:
-                self._check_node_visibility(caller)
+            self.omitting_callers.add(name)
+            self._check_node_visibility(name)
+            if n:
+                for caller in n.callers:
+                    self._check_node_visibility(caller)
 
     def omit_callees(self, name: str) -> None:
-        n = self._get_node(name)
-        name = n.name if n else name
+        with self.lock.write():
+            n = self._get_node(name)
+            name = n.name if n else name
 
-        self.omitting_callees.add(name)
-        self._check_node_visibility(name)
-        if n:
-            for callee in n.callees:
-                self._check_node_visibility(callee)
+            self.omitting_callees.add(name)
+            self._check_node_visibility(name)
+            if n:
+                for callee in n.callees:
+                    self._check_node_visibility(callee)
 
     def keep_node(self, name: str) -> None:
-        if self.keep is None:
-            self.keep = set()
+        with self.lock.write():
+            if self.keep is None:
+                self.keep = set()
 
-        n = self._get_node(name)
-        name = n.name if n else name
+            n = self._get_node(name)
+            name = n.name if n else name
 
-        self.keep.add(name)
-        if name in self.omitted:
-            self.omitted.remove(name)
+            self.keep.add(name)
+            if name in self.omitted:
+                self.omitted.remove(name)
 
     def reset_filter(self) -> None:
-        self.omitted = set()
-        self.omitting_callers = set()
-        self.omitting_callees = set()
-        self.keep = None
-        self.filter_default = True
+        with self.lock.write():
+            self.omitted = set()
+            self.omitting_callers = set()
+            self.omitting_callees = set()
+            self.keep = None
+            self.filter_default = True
+
+
+def strong_components(nodes: typing.Iterable[str],
+                      calls: typing.Callable[[str], list[str]]) -> list[list[str]]:
+    """Return the strongly connected components of the graph induced by
+       the given nodes, so that each component comes after all the
+       components that it can reach.  calls(name) must only return names
+       that are in nodes."""
+    # Iterative Tarjan; components are completed after all the
+    # components they can reach, which gives the order above.
+    result: list[list[str]] = []
+    index: dict[str, int] = {}
+    lowlink: dict[str, int] = {}
+    stack: list[str] = []
+    on_stack: set[str] = set()
+    for start in nodes:
+        if start in index:
+            continue
+        work = [(start, iter(calls(start)))]
+        index[start] = lowlink[start] = len(index)
+        stack.append(start)
+        on_stack.add(start)
+        while work:
+            name, it = work[-1]
+            callee = next(it, None)
+            if callee is not None:
+                if callee not in index:
+                    index[callee] = lowlink[callee] = len(index)
+                    stack.append(callee)
+                    on_stack.add(callee)
+                    work.append((callee, iter(calls(callee))))
+                elif callee in on_stack:
+                    lowlink[name] = min(lowlink[name], index[callee])
+                continue
+            work.pop()
+            if work:
+                parent = work[-1][0]
+                lowlink[parent] = min(lowlink[parent], lowlink[name])
+            if lowlink[name] == index[name]:
+                members = []
+                while True:
+                    x = stack.pop()
+                    on_stack.discard(x)
+                    members.append(x)
+                    if x == name:
+                        break
+                result.append(members)
+    return result
+
+
+class Condensation:
+    """The DAG of strongly connected components of the call edges, ignoring
+       the filter.  Once built, it is kept up to date by the Graph as nodes
+       and edges are added or removed.  self.ord is a topological order, in
+       which the successors of a component always have a lower position;
+       when the DAG is built, it is the same as the component numbers.
+
+       New edges are handled with the dynamic topological sort of Pearce
+       and Kelly, which only reorders the components between the two ends
+       of an edge that goes the wrong way, and merges the components on a
+       cycle if the edge closes one.  Removing an edge inside a component
+       splits it by running Tarjan's algorithm on its members only.  Either
+       way, only the cached closure sizes of the components that can reach
+       the edge are dropped.  Merged and split components leave an empty
+       entry in self.members.
+
+       Each node keeps its bit in closure bitsets for the whole life of the
+       condensation, and each component has the mask of its members' bits."""
+    def __init__(self, graph: Graph) -> None:
+        self.graph = graph
+        self.scc_of: dict[str, int] = {}
+        self.members: list[list[str]] = []
+        self.succ: list[set[int]] = []
+        self.pred: list[set[int]] = []
+        self.ord: list[int] = []
+        self.sizes: dict[int, int] = {}     # Closure sizes, computed on demand
+        self.mask: list[int] = []           # Bits of each component's members
+        self.bit: dict[str, int] = {}
+        self.order: list[str] = []          # Node of each bit
+
+        for members in strong_components(graph.nodes, self.calls):
+            self._new_component(members, ((1 << len(members)) - 1) << len(self.order))
+            self._add_bits(members)
+        for scc, members in enumerate(self.members):
+            self.succ[scc] = {self.scc_of[callee] for x in members for callee in self.calls(x)} - {scc}
+            for s in self.succ[scc]:
+                self.pred[s].add(scc)
+        self.ord = list(range(len(self.members)))
+        # Positions for new components with no edges, which can go at either end
+        self.low = -1
+        self.high = len(self.members)
+
+    def calls(self, name: str) -> list[str]:
+        return [callee for callee, type in self.graph.nodes[name].callees.items() if type == "call"]
+
+    def _add_bits(self, names: list[str]) -> None:
+        for x in names:
+            self.bit[x] = len(self.order)
+            self.order.append(x)
+
+    def _new_component(self, members: list[str], mask: int) -> int:
+        scc = len(self.members)
+        self.members.append(members)
+        self.mask.append(mask)
+        self.succ.append(set())
+        self.pred.append(set())
+        self.ord.append(0)
+        for x in members:
+            self.scc_of[x] = scc
+        return scc
+
+    def _invalidate(self, scc: int) -> None:
+        # Cached sizes are closed under successors, so the visit can
+        # stop at components whose size is not cached.
+        self.sizes.pop(scc, None)
+        stack = [scc]
+        while stack:
+            for p in self.pred[stack.pop()]:
+                if p in self.sizes:
+                    del self.sizes[p]
+                    stack.append(p)
+
+    def _search(self, start: int, edges: list[set[int]], ok: typing.Callable[[int], bool]) -> set[int]:
+        seen = {start}
+        stack = [start]
+        while stack:
+            for s in edges[stack.pop()]:
+                if s not in seen and ok(s):
+                    seen.add(s)
+                    stack.append(s)
+        return seen
+
+    def add_node(self, name: str) -> None:
+        if name not in self.scc_of:
+            scc = self._new_component([name], 1 << len(self.order))
+            self._add_bits([name])
+            self.ord[scc] = self.high
+            self.high += 1
+
+    def add_edge(self, caller: str, callee: str) -> None:
+        """Update the components for a new call edge."""
+        cu, cv = self.scc_of[caller], self.scc_of[callee]
+        if cu == cv or cv in self.succ[cu]:
+            return
+        if self.ord[cu] < self.ord[cv]:
+            if not self.succ[cv] and not self.pred[cv]:
+                self.ord[cv] = self.low
+                self.low -= 1
+            elif not self.succ[cu] and not self.pred[cu]:
+                self.ord[cu] = self.high
+                self.high += 1
+            else:
+                merged = self._reorder(cu, cv)
+                if merged is not None:
+                    self._invalidate(merged)
+                    return
+        self.succ[cu].add(cv)
+        self.pred[cv].add(cu)
+        self._invalidate(cu)
+
+    def _reorder(self, cu: int, cv: int) -> typing.Optional[int]:
+        # The descendants of cv and the ancestors of cu whose position is
+        # between the two are the only components that need to move.  They
+        # share their old positions, keeping their relative order: the
+        # former take the lowest ones and the latter the highest, so that
+        # none of them moves past a component outside the two sets.  The
+        # components in both sets are merged.  Return the merged component.
+        lb, ub = self.ord[cu], self.ord[cv]
+        fwd = self._search(cv, self.succ, lambda s: self.ord[s] >= lb)
+        bwd = self._search(cu, self.pred, lambda p: self.ord[p] <= ub)
+        pool = sorted(self.ord[x] for x in fwd | bwd)
+        cycle = fwd & bwd
+        below = sorted(fwd - cycle, key=self.ord.__getitem__)
+        above = sorted(bwd - cycle, key=self.ord.__getitem__)
+        for scc, pos in zip(below, pool):
+            self.ord[scc] = pos
+        for scc, pos in zip(above, pool[len(pool) - len(above):]):
+            self.ord[scc] = pos
+        if not cycle:
+            return None
+        merged = self._merge(cycle)
+        self.ord[merged] = pool[len(below)]
+        return merged
+
+    def _merge(self, cycle: set[int]) -> int:
+        # Move everything into the largest component, so that a big
+        # component that absorbs small ones is not copied every time
+        scc = max(cycle, key=lambda c: len(self.members[c]))
+        for c in cycle - {scc}:
+            for x in self.members[c]:
+                self.scc_of[x] = scc
+            self.members[scc] += self.members[c]
+            self.mask[scc] |= self.mask[c]
+            for s in self.succ[c]:
+                self.pred[s].discard(c)
+                if s not in cycle:
+                    self.pred[s].add(scc)
+                    self.succ[scc].add(s)
+            for p in self.pred[c]:
+                self.succ[p].discard(c)
+                if p not in cycle:
+                    self.succ[p].add(scc)
+                    self.pred[scc].add(p)
+            self.members[c], self.mask[c], self.succ[c], self.pred[c] = [], 0, set(), set()
+            self.sizes.pop(c, None)
+        self.succ[scc] -= cycle
+        self.pred[scc] -= cycle
+        return scc
+
+    def remove_edge(self, caller: str, callee: str) -> None:
+        """Update the components after a call edge was removed from the graph."""
+        cu, cv = self.scc_of[caller], self.scc_of[callee]
+        if cu == cv:
+            self._split(cu)
+        elif not any(self.scc_of[y] == cv for x in self.members[cu] for y in self.calls(x)):
+            self.succ[cu].discard(cv)
+            self.pred[cv].discard(cu)
+            self._invalidate(cu)
+
+    def _split(self, old: int) -> None:
+        members = set(self.members[old])
+        parts = strong_components(self.members[old],
+                                  lambda x: [y for y in self.calls(x) if y in members])
+        if len(parts) == 1:
+            return
+
+        self._invalidate(old)
+        for s in self.succ[old]:
+            self.pred[s].discard(old)
+        for p in self.pred[old]:
+            self.succ[p].discard(old)
+        self.members[old], self.mask[old], self.succ[old], self.pred[old] = [], 0, set(), set()
+        new = []
+        for part in parts:
+            mask = 0
+            for x in part:
+                mask |= 1 << self.bit[x]
+            new.append(self._new_component(part, mask))
+        for scc in new:
+            for x in self.members[scc]:
+                for y in self.calls(x):
+                    if self.scc_of[y] != scc:
+                        self.succ[scc].add(self.scc_of[y])
+                        self.pred[self.scc_of[y]].add(scc)
+                for y in self.graph.nodes[x].callers:
+                    if self.graph.nodes[y][x] == "call" and self.scc_of[y] not in new:
+                        self.succ[self.scc_of[y]].add(scc)
+                        self.pred[scc].add(self.scc_of[y])
+
+        # The parts take the place of the old component; this is rare
+        # enough that all positions can be renumbered
+        order = []
+        for scc in sorted((c for c in range(len(self.members)) if self.members[c] and c not in new),
+                          key=self.ord.__getitem__):
+            if self.ord[scc] > self.ord[old] and new:
+                order += new
+                new = []
+            order.append(scc)
+        order += new
+        for pos, scc in enumerate(order):
+            self.ord[scc] = pos
+        self.low, self.high = -1, len(order)
+
+    def reachable(self, roots: typing.Iterable[int]) -> set[int]:
+        seen = set(roots)
+        stack = list(seen)
+        while stack:
+            for s in self.succ[stack.pop()]:
+                if s not in seen:
+                    seen.add(s)
+                    stack.append(s)
+        return seen
+
+    def closure_bits(self, roots: typing.Iterable[int]) -> int:
+        """Return a bitset of the nodes reachable from the given components.
+           Each node has a fixed bit, and self.order lists the node of each bit.
+           The closure sizes of all visited components are cached."""
+        result = 0
+        for b in self.closures(roots).values():
+            result |= b
+        return result
+
+    def closures(self, roots: typing.Iterable[int]) -> dict[int, int]:
+        """Return the bitset of the nodes reachable from each of the given
+           components, visiting each reachable component only once."""
+        return dict(self.each_closure(roots))
+
+    def each_closure(self, roots: typing.Iterable[int]) -> typing.Iterator[tuple[int, int]]:
+        """Like closures(), but yield each component with its bitset as
+           soon as it is computed, so that they need not be kept all at once."""
+        roots = set(roots)
+        reach = self.reachable(roots)
+        pending: dict[int, int] = defaultdict(int)
+        for scc in reach:
+            for s in self.succ[scc]:
+                pending[s] += 1
+
+        # Successors come first.  A component's bitset is dropped as
+        # soon as all of its predecessors have been computed.
+        bits: dict[int, int] = {}
+        for scc in sorted(reach, key=self.ord.__getitem__):
+            b = self.mask[scc]
+            for s in self.succ[scc]:
+                b |= bits[s]
+                pending[s] -= 1
+                if not pending[s]:
+                    del bits[s]
+            self.sizes[scc] = popcount(b)
+            if pending[scc]:
+                bits[scc] = b
+            if scc in roots:
+                yield scc, b
+
+    BIT_TABLE = bytes.maketrans(b"01", b"\0\1")
+
+    def select(self, bits: int, values: typing.Sequence[T]) -> typing.Iterator[T]:
+        """Return the items of values, which is in the same order as
+           self.order, that correspond to the nodes in a bitset."""
+        return itertools.compress(values, bin(bits)[:1:-1].encode().translate(self.BIT_TABLE))
+
+    def names(self, bits: int) -> typing.Iterator[str]:
+        """Return the names of the nodes in a bitset."""
+        return self.select(bits, self.order)
+
+    def closure_size(self, name: str) -> int:
+        """Return the number of nodes reachable from name, including itself."""
+        n = self.graph._get_node(name)
+        if not n:
+            return 0
+        scc = self.scc_of[n.name]
+        if scc not in self.sizes:
+            self.closure_bits([scc])
+        return self.sizes[scc]
+
+
+class CallGraph:
+    """Python API for queries on a call graph, for example in tests:
+
+           graph = vrc.CallGraph.load(["build"])
+           assert not graph.reaches("irq_handler", "malloc"), graph.path("irq_handler", "malloc")
+
+       Functions can be given by assembler name or by username, and results
+       are sets or lists of assembler names.  Only call edges are followed,
+       unless ref is True.  If the graph was saved with a filter, omitted
+       functions and edges are invisible.  The graph must not be modified
+       through this class; it can be shared by any number of readers."""
+    def __init__(self, graph: Graph) -> None:
+        self.graph = graph
+
+    @staticmethod
+    def inputs(paths: typing.Iterable[str]) -> list[str]:
+        """Return the files that load() reads for paths."""
+        result = []
+        for path in paths:
+            if os.path.isdir(path):
+                result += sorted(glob.glob(os.path.join(path, "**", "*r.expand"), recursive=True))
+                result += sorted(glob.glob(os.path.join(path, "**", "*.vrc"), recursive=True))
+            else:
+                result.append(path)
+        return result
+
+    @staticmethod
+    def load(paths: typing.Iterable[str]) -> "CallGraph":
+        """Read RTL dumps, files written by vrc-cc, and the dumps and
+           vrc-cc files in directories, recursively."""
+        def ignore(*args: typing.Any) -> None:
+            pass
+
+        graph = Graph()
+        for fn in CallGraph.inputs(paths):
+            with open(fn, "r") as f:
+                if fn.endswith(".vrc"):
+                    graph.parse_records(f, verbose_print=ignore)
+                else:
+                    graph.parse(fn, f, verbose_print=ignore, local=local_functions(fn))
+        for file in list(graph.nodes_by_file):
+            graph.read_code_sizes(file, object_file(file))
+        return CallGraph(graph)
+
+    @staticmethod
+    def restore(fn: str) -> "CallGraph":
+        """Read a graph written by save() or by the "save" command."""
+        return CallGraph(Graph.restore(fn))
+
+    def save(self, fn: str) -> None:
+        self.graph.save(fn)
+
+    def __contains__(self, func: str) -> bool:
+        return self._node(func) is not None
+
+    def _node(self, func: str) -> typing.Optional[Node]:
+        n = self.graph._get_node(func)
+        return n if n and self.graph._filter_node(n, True) else None
+
+    def id(self, func: str) -> str:
+        """Return the assembler name of a function.  Raise KeyError if it
+           is not in the graph."""
+        n = self._node(func)
+        if not n:
+            raise KeyError(func)
+        return n.name
+
+    def username(self, func: str) -> typing.Optional[str]:
+        n = self.graph.nodes[self.id(func)]
+        return n.username
+
+    def file(self, func: str) -> typing.Optional[str]:
+        """Return the dump or object file that defines a function."""
+        return self.graph.nodes[self.id(func)].file
+
+    def functions(self, external: bool = False) -> set[str]:
+        """Return the defined functions, and the external ones if requested."""
+        with self.graph.lock.read():
+            return {name for name, n in self.graph.nodes.items() if self.graph._filter_node(n, external)}
+
+    def _callees(self, n: Node, ref: bool) -> typing.Iterator[Node]:
+        for callee in n.callees:
+            m = self.graph.nodes[callee]
+            if self.graph._filter_node(m, True) and self.graph._filter_edge(n, m, ref):
+                yield m
+
+    def _callers(self, n: Node, ref: bool) -> typing.Iterator[Node]:
+        for caller in n.callers:
+            m = self.graph.nodes[caller]
+            if self.graph._filter_node(m, True) and self.graph._filter_edge(m, n, ref):
+                yield m
+
+    def callees(self, func: str, ref: bool = False) -> set[str]:
+        with self.graph.lock.read():
+            return {m.name for m in self._callees(self.graph.nodes[self.id(func)], ref)}
+
+    def callers(self, func: str, ref: bool = False) -> set[str]:
+        with self.graph.lock.read():
+            return {m.name for m in self._callers(self.graph.nodes[self.id(func)], ref)}
+
+    def _bfs(self, start: str, ref: bool, callers: bool,
+             stop: typing.Optional[str] = None) -> dict[str, typing.Optional[str]]:
+        # Map each visited node to the node it was reached from
+        targets = self._callers if callers else self._callees
+        parent: dict[str, typing.Optional[str]] = {self.id(start): None}
+        queue = deque([self.graph.nodes[self.id(start)]])
+        while queue and stop not in parent:
+            n = queue.popleft()
+            for m in targets(n, ref):
+                if m.name not in parent:
+                    parent[m.name] = n.name
+                    queue.append(m)
+        return parent
+
+    def reachable(self, func: str, ref: bool = False) -> set[str]:
+        """Return the functions that func can call, recursively, including itself."""
+        with self.graph.lock.read():
+            return set(self._bfs(func, ref, callers=False))
+
+    def reaching(self, func: str, ref: bool = False) -> set[str]:
+        """Return the functions that can call func, recursively, including itself."""
+        with self.graph.lock.read():
+            return set(self._bfs(func, ref, callers=True))
+
+    def reaches(self, src: str, dst: str, ref: bool = False) -> bool:
+        """Return whether src is dst or can call it, directly or indirectly.
+           Raise KeyError if src is not in the graph; dst need not be."""
+        return self.path(src, dst, ref) is not None
+
+    def path(self, src: str, dst: str, ref: bool = False) -> typing.Optional[list[str]]:
+        """Return a shortest call chain from src to dst, or None."""
+        with self.graph.lock.read():
+            if dst not in self:
+                return None
+            dst = self.id(dst)
+            parent = self._bfs(src, ref, callers=False, stop=dst)
+            if dst not in parent:
+                return None
+            result = [dst]
+            while True:
+                prev = parent[result[-1]]
+                if prev is None:
+                    return result[::-1]
+                result.append(prev)
 
 
 GRAPH = Graph()
 
 
+class Prefetcher:
+    """While the REPL waits for input, compute in a background thread the
+       answers to the queries that usually follow: the callers and callees
+       of the functions that the last command printed, and their closures.
+       The results are valid until the graph or the filter change."""
+    MAX_NAMES = 64
+
+    def __init__(self) -> None:
+        self.enabled = False
+        self.names: list[str] = []
+        self.graph: typing.Optional[Graph] = None
+        self.generation = -1
+        self.cache: dict[tuple[typing.Any, ...], typing.Any] = {}
+        self.cancelled = threading.Event()
+        self.thread: typing.Optional[threading.Thread] = None
+
+    def _check_cache(self) -> None:
+        if self.graph is not GRAPH or self.generation != GRAPH.lock.generation:
+            self.cache = {}
+            self.graph = GRAPH
+            self.generation = GRAPH.lock.generation
+
+    def note(self, names: typing.Iterable[str]) -> None:
+        """Remember names printed by the current command."""
+        if self.enabled:
+            for name in names:
+                if len(self.names) < self.MAX_NAMES and name not in self.names:
+                    self.names.append(name)
+
+    def start(self) -> None:
+        """Start prefetching for the names that were printed since the last call."""
+        names, self.names = self.names, []
+        if not self.enabled or not names:
+            return
+        self._check_cache()
+        self.cancelled.clear()
+        self.thread = threading.Thread(target=self._run, args=(self.graph, names), daemon=True)
+        self.thread.start()
+
+    def cancel(self) -> None:
+        """Stop the background thread before a command runs."""
+        if self.thread:
+            self.cancelled.set()
+            self.thread.join()
+            self.thread = None
+
+    def _run(self, graph: Graph, names: list[str]) -> None:
+        for name in names:
+            if self.cancelled.is_set():
+                return
+            self.cache.setdefault(("callers", name, False), list(graph.callers(name, False)))
+            self.cache.setdefault(("callees", name, False, False), list(graph.callees(name, False, False)))
+        for name in names:
+            for callers in (True, False):
+                if ("closure", name, callers) not in self.cache:
+                    result = self._closure(graph, name, callers)
+                    if result is None:
+                        return
+                    self.cache["closure", name, callers] = result
+
+    def _closure(self, graph: Graph, name: str, callers: bool) -> typing.Optional[set[str]]:
+        # Same result as graph.closure([name]), but check for cancellation
+        # every few nodes
+        n = graph._get_node(name)
+        if not n:
+            return set()
+        targets = Graph._callers if callers else Graph._callees
+        seen = {n.name}
+        stack = [n]
+        visited = 0
+        while stack:
+            visited += 1
+            if visited % 256 == 0 and self.cancelled.is_set():
+                return None
+            for x in targets(stack.pop()):
+                if x not in seen:
+                    seen.add(x)
+                    stack.append(graph.nodes[x])
+        return seen
+
+    def _get(self, key: tuple[typing.Any, ...], compute: typing.Callable[[], typing.Any]) -> typing.Any:
+        if not self.enabled:
+            return compute()
+        self._check_cache()
+        if key not in self.cache:
+            self.cache[key] = compute()
+        return self.cache[key]
+
+    def callers(self, name: str, ref_ok: bool) -> list[str]:
+        return self._get(("callers", name, ref_ok), lambda: list(GRAPH.callers(name, ref_ok)))
+
+    def callees(self, name: str, external_ok: bool, ref_ok: bool) -> list[str]:
+        return self._get(("callees", name, external_ok, ref_ok),
+                         lambda: list(GRAPH.callees(name, external_ok, ref_ok)))
+
+    def closure(self, roots: typing.Sequence[str], callers: bool) -> set[str]:
+        if self.enabled:
+            self._check_cache()
+            if all(("closure", root, callers) in self.cache for root in roots):
+                return set().union(*(self.cache["closure", root, callers] for root in roots))
+        return GRAPH.closure(roots, callers)
+
+    def metrics(self, names: typing.Sequence[str], closure: bool) -> dict[str, NodeMetrics]:
+        if self.enabled:
+            self._check_cache()
+
+            def cached(name: str) -> bool:
+                keys = [("callers", name, False), ("callees", name, False, False)]
+                if closure:
+                    keys += [("closure", name, True), ("closure", name, False)]
+                return all(key in self.cache for key in keys)
+
+            if all(cached(name) for name in names):
+                result = {}
+                for name in names:
+                    m = NodeMetrics(callers=len(self.callers(name, False)),
+                                    callees=len(self.callees(name, False, False)))
+                    if closure:
+                        m.all_callers = len(self.closure([name], True)) - 1
+                        m.all_callees = len(self.closure([name], False)) - 1
+                    result[name] = m
+                return result
+        return GRAPH.metrics(names, closure)
+
+
+PREFETCHER = Prefetcher()
+
+
 class NoUsageFormatter(argparse.HelpFormatter):
     def add_usage(self, usage: typing.Optional[str], actions: typing.Iterable[argparse.Action],
                   groups: typing.Iterable[argparse._ArgumentGroup], prefix: typing.Optional[str] = ...) -> None:
@@ -285,15 +1799,49 @@ class MyArgumentParser(argparse.ArgumentParser):
 PARSER = MyArgumentParser()
 
 
+def file_label(file: str) -> str:
+    """Return a short name for a dump file, without the pass suffix."""
+    file = os.path.relpath(file)
+    m = re.match(r'(.*?)\.[0-9]*r\.expand', file)
+    return m.group(1) if m else file
+
+
+def source_file(file: str) -> str:
+    """Return the name of the source file that a dump was generated from,
+       if it can be found in compile_commands.json."""
+    m = re.match(r'(.*?)(\.[0-9]*r\.expand)?$', os.path.abspath(file))
+    if m and m.group(1) in COMPDB:
+        entry = COMPDB[m.group(1)]
+        return os.path.relpath(os.path.join(entry.directory, entry.file))
+    return file_label(file)
+
+
+def dot_string(s: str) -> str:
+    """Quote s as a DOT string, so that C++ names with quotes or backslashes
+       do not end the string early."""
+    return '"' + s.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
 class VRCCommand:
 
     NAME: typing.Optional[tuple[str, ...]] = None
+    # True if the command only changes the graph, the filter or the
+    # compilation database, so that "source --memo" can skip it
+    MEMO = False
+    # True if the command changes the state that inputs() looks at; it
+    # is run on a scratch copy while "source --memo" fingerprints a script
+    CHANGES_INPUTS = False
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
         """Setup argument parser"""
         pass
 
+    @classmethod
+    def inputs(self, args: argparse.Namespace) -> list[str]:
+        """Return the files that the command reads, for "source --memo"."""
+        return []
+
     def run(self, args: argparse.Namespace):
         pass
 
@@ -332,25 +1880,353 @@ class HistoryCommand(VRCCommand):
 class CompdbCommand(VRCCommand):
     """Loads a compile_commands.json file."""
     NAME = ("compdb",)
+    MEMO = True
+    CHANGES_INPUTS = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
         parser.add_argument("file", metavar="FILE",
                             help="JSON file to be loaded")
 
+    @classmethod
+    def inputs(self, args: argparse.Namespace) -> list[str]:
+        return [args.file]
+
     def run(self, args: argparse.Namespace):
+        global COMPILE_TIMES_FILE
+        classes: dict[str, list[str]] = {}
+        for key, objs in EQUIVALENT_OBJECTS.items():
+            classes[translation_unit_key(COMPDB[key])] = objs
         with open(args.file, 'r') as f:
             for entry in json.load(f):
+                if "output" not in entry:
+                    continue
                 key = os.path.abspath(os.path.join(entry["directory"], entry["output"]))
-                COMPDB[key] = entry["command"]
+                command = entry["command"] if "command" in entry else shlex.join(entry["arguments"])
+                COMPDB[key] = CompdbEntry(directory=entry["directory"],
+                                          file=entry["file"], command=command)
+
+                # Objects that are compiled from the same source with the same
+                # options share the list of equivalent objects.  The first one
+                # is the representative.
+                tu = translation_unit_key(COMPDB[key])
+                if tu not in classes:
+                    classes[tu] = []
+                old = EQUIVALENT_OBJECTS.get(key)
+                if old is not classes[tu]:
+                    if old is not None:
+                        old.remove(key)
+                    classes[tu].append(key)
+                    EQUIVALENT_OBJECTS[key] = classes[tu]
+
+        COMPILE_TIMES_FILE = os.path.join(os.path.dirname(os.path.abspath(args.file)),
+                                          ".vrc-times.json")
+        try:
+            with open(COMPILE_TIMES_FILE, 'r') as f:
+                COMPILE_TIMES.update(json.load(f))
+        except (OSError, ValueError):
+            pass
+
+
+@dataclasses.dataclass
+class CompdbEntry:
+    directory: str
+    file: str
+    command: str
+
+
+COMPDB: dict[str, CompdbEntry] = dict()
+
+# Maps each object file to all the objects that are compiled
+# from the same source file with the same options.
+EQUIVALENT_OBJECTS: dict[str, list[str]] = dict()
+
+# How long it took to generate the dump for each object file, in seconds.
+# Saved next to compile_commands.json to schedule later compilations.
+COMPILE_TIMES: dict[str, float] = dict()
+COMPILE_TIMES_FILE: typing.Optional[str] = None
+
+
+def dump_option(args: list[str], slim: bool = False) -> str:
+    """Return the option that asks GCC for the RTL dump.  If the compiler
+       uses profile feedback, the dump includes the basic blocks and their
+       execution counts; GCC 12 prints the counts only if both "blocks"
+       and "details" are given."""
+    option = '-fdump-rtl-expand-slim' if slim else '-fdump-rtl-expand'
+    if any(arg.startswith(('-fprofile-use', '-fauto-profile')) for arg in args):
+        option += '-blocks-details'
+    return option
+
+
+def build_gcc_S_command_line(cmd: str, outfile: str, slim: bool = False,
+                             remarks: bool = False) -> list[str]:
+    args = shlex.split(cmd)
+    out = []
+    was_o = False
+    for i in args:
+        if was_o:
+            i = '/dev/null'
+            was_o = False
+        elif i == '-c':
+            i = '-S'
+        elif i == '-o':
+            was_o = True
+        out.append(i)
+    out += [dump_option(args, slim), '-dumpbase', outfile]
+    if remarks:
+        out.append(f'-fopt-info-inline-all={remarks_file(outfile)}')
+    return out
+
+
+def remarks_file(obj: str) -> str:
+    """Return the name of the inlining remarks file for an object or dump."""
+    return re.sub(r'\.[0-9]*r\.expand$', '', obj) + '.inline'
+
+
+def object_file(dump: str) -> str:
+    """Return the name of the object file for a dump."""
+    return re.sub(r'\.[0-9]*r\.expand$', '', dump)
+
+
+class ElfSymbol(typing.NamedTuple):
+    size: int
+    binding: int        # STB_LOCAL, STB_GLOBAL or STB_WEAK
+
+
+STB_LOCAL = 0
+STB_GLOBAL = 1
+STB_WEAK = 2
+
+
+def elf_symbols(fn: str) -> typing.Iterator[tuple[str, int, int, int, str]]:
+    """Yield the name, st_info, st_shndx and st_size of each symbol in the
+       symbol table of an ELF file, and the name of its section.  Yield
+       nothing if the file is missing or not ELF."""
+    try:
+        with open(fn, "rb") as f:
+            data = f.read()
+    except OSError:
+        return
+    if data[:4] != b"\x7fELF" or data[4] not in (1, 2):
+        return
+
+    is64 = data[4] == 2
+    endian = "<" if data[5] == 1 else ">"
+    if is64:
+        shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x3A)
+        shdr, sym = endian + "IIQQQQIIQQ", endian + "IBBHQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+        shdr, sym = endian + "IIIIIIIIII", endian + "IIIBBH"
+
+    # (type, offset, size, link, entsize) and name offset of each section
+    sections = []
+    name_offsets = []
+    for i in range(shnum):
+        fields = struct.unpack_from(shdr, data, shoff + i * shentsize)
+        sections.append((fields[1], fields[4], fields[5], fields[6], fields[9]))
+        name_offsets.append(fields[0])
+    section_names = [""] * shnum
+    if shstrndx < shnum:
+        shstrtab = sections[shstrndx][1]
+        section_names = [data[shstrtab + i:data.index(b"\0", shstrtab + i)].decode() for i in name_offsets]
+
+    for type, offset, size, link, entsize in sections:
+        if type != 2 or not entsize:        # SHT_SYMTAB
+            continue
+        strtab = sections[link][1]
+        for pos in range(offset, offset + size, entsize):
+            if is64:
+                name, info, _, shndx, _, st_size = struct.unpack_from(sym, data, pos)
+            else:
+                name, _, st_size, info, _, shndx = struct.unpack_from(sym, data, pos)
+            end = data.index(b"\0", strtab + name)
+            section = section_names[shndx] if shndx < shnum else ""
+            yield data[strtab + name:end].decode(), info, shndx, st_size, section
+
+
+def elf_functions(fn: str) -> dict[str, ElfSymbol]:
+    """Read the function symbols from the symbol table of an ELF file.
+       Return an empty dictionary if the file is missing or not ELF."""
+    # Defined STT_FUNC symbols
+    return {name: ElfSymbol(size, info >> 4) for name, info, shndx, size, _ in elf_symbols(fn)
+            if info & 15 == 2 and shndx != 0}
+
+
+def elf_function_sections(fn: str) -> dict[str, str]:
+    """Return the section of each function defined by an ELF file."""
+    return {name: section for name, info, shndx, _, section in elf_symbols(fn)
+            if info & 15 == 2 and shndx != 0}
+
+
+def elf_undefined(fn: str) -> set[str]:
+    """Return the symbols that an ELF file uses but does not define, for
+       example functions whose address is in a vtable or another table."""
+    return {name for name, _, shndx, _, _ in elf_symbols(fn) if shndx == 0 and name}
+
+
+def local_functions(fn: str) -> set[str]:
+    """Return the functions that are defined with STB_LOCAL binding by an
+       object file, or by the object file of a dump.  Return an empty set
+       if the object file is missing."""
+    obj = object_file(fn)
+    if not obj.endswith(".o"):
+        return set()
+    return {name for name, symbol in elf_functions(obj).items() if symbol.binding == STB_LOCAL}
+
+
+def translation_unit_key(entry: CompdbEntry) -> str:
+    """Hash the source file and the command line, except for the options
+       that only affect the name of the output and dependency files."""
+    args = []
+    skip = False
+    for i in shlex.split(entry.command):
+        if skip:
+            skip = False
+        elif i in ('-o', '-MF', '-MT', '-MQ'):
+            skip = True
+        elif i in ('-MD', '-MMD') or i.startswith(('-o', '-MF', '-MT', '-MQ', '-Wp,-MD,', '-Wp,-MMD,')):
+            pass
+        else:
+            args.append(i)
+    source = os.path.join(entry.directory, entry.file)
+    return hashlib.sha1(json.dumps([entry.directory, source, args]).encode()).hexdigest()
+
+
+def find_dumps(obj: str) -> list[str]:
+    return glob.glob(obj + ".*r.expand")
+
+
+def generate_dump(obj: str, verbose_print, slim: bool = False, remarks: bool = False) -> bool:
+    """Compile the object file's source to produce an RTL dump next to
+       the object, and optionally the inlining remarks.  Return True if
+       the compiler was successful."""
+    entry = COMPDB[obj]
+    cmdline = build_gcc_S_command_line(entry.command, obj, slim, remarks)
+    verbose_print(f"Launching {shlex.join(cmdline)}")
+    start = time.monotonic()
+    try:
+        result = subprocess.run(cmdline, stdin=subprocess.DEVNULL, cwd=entry.directory)
+    except OSError as e:
+        print(f"Could not compile {os.path.relpath(obj)}: {e}", file=sys.stderr)
+        return False
+    if result.returncode != 0:
+        print(f"Compiler exited with return code {result.returncode}", file=sys.stderr)
+        return False
+    COMPILE_TIMES[obj] = time.monotonic() - start
+    return True
+
+
+def compdb_objects() -> list[str]:
+    """Return the object files in compile_commands.json, skipping the
+       entries that preprocess, assemble or precompile a header."""
+    return sorted(obj for obj, entry in COMPDB.items()
+                  if obj.endswith(".o") and compile_output(shlex.split(entry.command)[1:]))
+
+
+def largest_first(objs: typing.Iterable[str]) -> list[str]:
+    """Sort object files by decreasing compilation time, so that the
+       longest compilations do not end up last.  The time is estimated
+       from previous runs, or from the size of the source file."""
+    def source_size(obj: str) -> int:
+        entry = COMPDB[obj]
+        try:
+            return os.path.getsize(os.path.join(entry.directory, entry.file))
+        except OSError:
+            return 0
+
+    objs = list(objs)
+    sizes = {obj: source_size(obj) for obj in objs}
+    known = [obj for obj in COMPILE_TIMES if obj in COMPDB]
+    known_size = sum(source_size(obj) for obj in known)
+    rate = sum(COMPILE_TIMES[obj] for obj in known) / known_size if known_size else 1.0
+    return sorted(objs, key=lambda obj: COMPILE_TIMES.get(obj, sizes[obj] * rate), reverse=True)
+
+
+def save_compile_times() -> None:
+    if COMPILE_TIMES_FILE is None:
+        return
+    try:
+        with open(COMPILE_TIMES_FILE, 'w') as f:
+            json.dump(COMPILE_TIMES, f, indent=0, sort_keys=True)
+    except OSError as e:
+        print(f"Could not save compilation times: {e}", file=sys.stderr)
+
+
+def resolve_dumps(files: typing.Iterable[str], verbose_print, jobs: int,
+                  slim: bool = False, remarks: bool = False) -> typing.Iterator[str]:
+    """Map the arguments of "load" to dump files.  Object files are looked
+       up in compile_commands.json and compiled if their dump is missing."""
+    def expand_glob(s: str) -> list[str]:
+        return glob.glob(s) or [s]
+
+    cwd = os.getcwd()
+    todo = []
+    seen = set()
+    for pattern in files:
+        for fn in expand_glob(os.path.join(cwd, os.path.expanduser(pattern))):
+            if fn.endswith(".o"):
+                if fn not in COMPDB:
+                    print(f"Could not find '{fn}' in compile_commands.json", file=sys.stderr)
+                    continue
+
+                # Only load one of the equivalent objects, preferably
+                # one whose dump is already there
+                objs = EQUIVALENT_OBJECTS.get(fn, [fn])
+                rep = next((obj for obj in objs if obj in seen or find_dumps(obj)), objs[0])
+                if rep != fn:
+                    verbose_print(f"Using {os.path.relpath(rep)} for {os.path.relpath(fn)}")
+                fn = rep
+            if fn not in seen:
+                seen.add(fn)
+                todo.append(fn)
+
+    # Objects are compiled in the background, largest first, but
+    # the dumps are parsed in the order of the command line.
+    def needs_compile(obj: str) -> bool:
+        return not find_dumps(obj) or (remarks and not os.path.exists(remarks_file(obj)))
+
+    missing = largest_first(fn for fn in todo if fn.endswith(".o") and needs_compile(fn))
+    pool = concurrent.futures.ThreadPoolExecutor(max(1, jobs))
+    try:
+        compiled = {fn: pool.submit(generate_dump, fn, verbose_print, slim, remarks) for fn in missing}
+        for fn in todo:
+            if not fn.endswith(".o"):
+                verbose_print(f"Reading {os.path.relpath(fn)}")
+                yield fn
+                continue
+
+            if fn in compiled:
+                if not compiled[fn].result():
+                    continue
+            dumps = find_dumps(fn)
+            if not dumps:
+                print("Compiler did not produce dump file", file=sys.stderr)
+                continue
+            if len(dumps) > 1:
+                print(f"Found more than one dump file: {', '.join(dumps)}", file=sys.stderr)
+                continue
+
+            print(f"Reading {os.path.relpath(dumps[0])}", file=sys.stderr)
+            yield dumps[0]
+    except KeyboardInterrupt:
+        print("Interrupt", file=sys.stderr)
+    finally:
+        pool.shutdown(cancel_futures=True)
+        if missing:
+            save_compile_times()
 
 
-COMPDB: dict[str, str] = dict()
+# Dumps of at least this size are parsed in pieces by "load"
+SPLIT_SIZE = 64 << 20
 
 
 class LoadCommand(VRCCommand):
     """Loads a GCC RTL output (.expand, generated by -fdump-rtl-expand)."""
     NAME = ("load",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -363,73 +2239,394 @@ class LoadCommand(VRCCommand):
         parser.add_argument("--verbose", action="store_const",
                             const=print_stderr, default=eat,
                             help="Report progress while parsing")
-        parser.add_argument("files", metavar="FILE", nargs="+",
+        parser.add_argument("--all", action="store_true",
+                            help="Load all object files in compile_commands.json")
+        parser.add_argument("--verify-duplicates", action="store_true",
+                            help="Check that functions defined in multiple files have the same edges")
+        parser.add_argument("--jobs", "-j", metavar="N", type=int, default=os.cpu_count() or 1,
+                            help="Run up to N compilers in parallel")
+        parser.add_argument("--slim", action="store_true",
+                            help="Generate missing dumps in the smaller slim format")
+        parser.add_argument("--remarks", action="store_true",
+                            help="Also generate missing inlining remarks (-fopt-info-inline-all)")
+        parser.add_argument("--store", metavar="DIR",
+                            help="Load the edges collected by vrc-cc in DIR")
+        parser.add_argument("files", metavar="FILE", nargs="*",
                             help="Dump or object file to be loaded")
 
+    @classmethod
+    def inputs(self, args: argparse.Namespace) -> list[str]:
+        # Dumps that are missing now are compiled by "load", so the next
+        # run will see a different fingerprint
+        result = []
+        for pattern in list(args.files) + (compdb_objects() if args.all else []):
+            for fn in glob.glob(os.path.expanduser(pattern)) or [pattern]:
+                if fn.endswith(".o"):
+                    dumps = [dump for obj in EQUIVALENT_OBJECTS.get(os.path.abspath(fn), [fn])
+                             for dump in find_dumps(obj)]
+                else:
+                    dumps = [fn]
+                result.append(fn)
+                for dump in dumps:
+                    result += [dump, object_file(dump), remarks_file(dump)]
+        if args.store:
+            result += sorted(glob.glob(os.path.join(os.path.expanduser(args.store), "*.vrc")))
+        return result
+
     def run(self, args: argparse.Namespace):
-        def build_gcc_S_command_line(cmd, outfile):
-            args = shlex.split(cmd)
-            out = []
-            was_o = False
-            for i in args:
-                if was_o:
-                    i = '/dev/null'
-                    was_o = False
-                elif i == '-c':
-                    i = '-S'
-                elif i == '-o':
-                    was_o = True
-                out.append(i)
-            return out + ['-fdump-rtl-expand', '-dumpbase', outfile]
-
-        def expand_glob(s: str) -> list[str]:
-            return glob.glob(s) or [s]
-
-        def resolve(files: typing.Iterator[str]) -> typing.Iterator[str]:
-            cwd = os.getcwd()
-            for pattern in files:
-                for fn in expand_glob(os.path.join(cwd, os.path.expanduser(pattern))):
-                    if fn.endswith(".o"):
-                        if fn not in COMPDB:
-                            print(f"Could not find '{fn}' in compile_commands.json", file=sys.stderr)
-                            continue
+        if not args.files and not args.all and not args.store:
+            raise argparse.ArgumentError(None, "load: no files specified")
+
+        if args.store:
+            stored = sorted(glob.glob(os.path.join(os.path.expanduser(args.store), "*.vrc")))
+            if not stored:
+                print(f"No vrc-cc output in {args.store}", file=sys.stderr)
+            before = set(GRAPH.nodes_by_file)
+            for fn in stored:
+                args.verbose(f"Reading {os.path.relpath(fn)}")
+                with open(fn, "r") as f:
+                    GRAPH.parse_records(f, verbose_print=args.verbose,
+                                        verify_duplicates=args.verify_duplicates)
+            # Stored records are attributed to the object file itself
+            for obj in sorted(set(GRAPH.nodes_by_file) - before):
+                GRAPH.read_code_sizes(obj, obj)
+
+        files = list(args.files)
+        if args.all:
+            files += compdb_objects()
+        # Remarks can refer to functions in other files, read them last
+        remarks = []
+        pool: typing.Optional[concurrent.futures.Executor] = None
+        try:
+            for fn in resolve_dumps(files, args.verbose, args.jobs, args.slim, args.remarks):
+                # Unity builds and LTO partitions can produce a single huge dump
+                try:
+                    local = local_functions(fn)
+                    if args.jobs > 1 and os.path.getsize(fn) >= SPLIT_SIZE:
+                        pool = pool or concurrent.futures.ProcessPoolExecutor(args.jobs)
+                        GRAPH.parse_split(fn, pool, 4 * args.jobs, verbose_print=args.verbose,
+                                          local=local, verify_duplicates=args.verify_duplicates)
+                    else:
+                        with open(fn, "r") as f:
+                            GRAPH.parse(fn, f, verbose_print=args.verbose,
+                                        local=local, verify_duplicates=args.verify_duplicates)
+                except OSError as e:
+                    print(f"Could not read {fn}: {e}", file=sys.stderr)
+                    continue
+                if object_file(fn) != fn:
+                    GRAPH.read_code_sizes(fn, object_file(fn))
+                if os.path.exists(remarks_file(fn)):
+                    remarks.append(remarks_file(fn))
+        finally:
+            if pool:
+                pool.shutdown()
+        for fn in remarks:
+            args.verbose(f"Reading {os.path.relpath(fn)}")
+            with open(fn, "r") as f:
+                GRAPH.parse_remarks(fn, f, verbose_print=args.verbose)
+
+
+def extract_records(fn: str, lines: typing.Iterable[str], binary: bool,
+                    local: typing.Collection[str] = ()) -> typing.Iterator[bytes]:
+    """Encode the functions and edges of an RTL dump, one chunk per function.
+       In the line format, each record is a tab-separated line:
+
+       L FILE NAME...
+       F FILE NAME USERNAME SIZE [FREQUENCY]
+       E CALLER CALLEE TYPE CALL-SITES PROFILE-COUNT [BOTH]
+
+       where the L record comes first and lists the static functions
+       given by local, if any, the username and the profile count can be
+       empty, the frequency is only present if GCC printed one, and BOTH
+       is "1" if the callee is both called and referenced.  In the
+       binary format, each record is a 4-byte big-endian length followed
+       by the same fields separated by NUL bytes."""
+    def encode(*fields: typing.Any) -> bytes:
+        if binary:
+            payload = b"\0".join(str(x).encode() for x in fields)
+            return len(payload).to_bytes(4, "big") + payload
+        return ("\t".join(str(x) for x in fields) + "\n").encode()
+
+    username = None
+    frequency: tuple[str, ...] = ()
+    callees: dict[str, str] = {}
+    both: set[str] = set()
+    calls: dict[str, int] = {}
+    counts: dict[str, int] = {}
+    if local:
+        yield encode("L", fn, *sorted(local))
+    for record in scan_dump(lines, lambda name: True):
+        if record[0] == "function":
+            username = record[2]
+            frequency = ()
+            callees, both, calls, counts = {}, set(), {}, {}
+        elif record[0] == "frequency":
+            frequency = (record[2],)
+        elif record[0] == "edge":
+            # Same as Node.__setitem__
+            old = callees.get(record[1])
+            if old is not None and old != record[2]:
+                both.add(record[1])
+            if record[2] == "call" or old is None:
+                callees[record[1]] = record[2]
+        elif record[0] == "call_site":
+            calls[record[1]] = calls.get(record[1], 0) + 1
+            if record[2] is not None:
+                counts[record[1]] = counts.get(record[1], 0) + record[2]
+        else:
+            name = record[1]
+            chunk = [encode("F", fn, name, username or "", record[2], *frequency)]
+            for callee, type in callees.items():
+                extra = ("1",) if callee in both else ()
+                chunk.append(encode("E", name, callee, type, calls.get(callee, 0), counts.get(callee, ""),
+                                    *extra))
+            yield b"".join(chunk)
+
+
+def extract_dump(fn: str, binary: bool) -> bytes:
+    with open(fn, "r") as f:
+        return b"".join(extract_records(fn, f, binary, local_functions(fn)))
+
+
+def split_dump(fn: str, pieces: int) -> list[tuple[int, int]]:
+    """Split a dump into up to the given number of byte ranges of similar
+       size.  Each range except the first starts at a ";; Function" line."""
+    with open(fn, "rb") as f:
+        size = os.fstat(f.fileno()).st_size
+        if size == 0:
+            return [(0, 0)]
+        offsets = [0]
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            for i in range(1, pieces):
+                pos = m.find(b"\n;; Function ", max(offsets[-1], size * i // pieces))
+                if pos == -1:
+                    break
+                if pos + 1 > offsets[-1]:
+                    offsets.append(pos + 1)
+        offsets.append(size)
+    return list(zip(offsets, offsets[1:]))
+
+
+def extract_range(fn: str, start: int, end: int, local: typing.Collection[str] = ()) -> bytes:
+    with open(fn, "rb") as f:
+        f.seek(start)
+        text = f.read(end - start).decode()
+    return b"".join(extract_records(fn, io.StringIO(text), binary=False, local=local))
+
+
+def store_file(store: str, obj: str) -> str:
+    """Return the file of a store directory that holds the records of obj."""
+    digest = hashlib.sha1(obj.encode()).hexdigest()[:16]
+    return os.path.join(store, f"{os.path.basename(obj)}-{digest}.vrc")
+
+
+def store_dump(store: str, obj: str, dump: str) -> None:
+    """Write the records of a dump to the store.  Each object file has its
+       own file, which is written under a temporary name and then renamed,
+       so that any number of compilers can run at the same time and a
+       rebuilt object replaces its old records."""
+    os.makedirs(store, exist_ok=True)
+    target = store_file(store, obj)
+    tmp = f"{target}.{os.getpid()}.tmp"
+    try:
+        with open(tmp, "wb") as f, open(dump, "r") as lines:
+            # Functions are attributed to the object file, not to the dump
+            for chunk in extract_records(obj, lines, binary=False, local=local_functions(obj)):
+                f.write(chunk)
+        os.replace(tmp, target)
+    except BaseException:
+        # Do not hide the original error if tmp was never created
+        with contextlib.suppress(OSError):
+            os.unlink(tmp)
+        raise
+
+
+SOURCE_SUFFIXES = {".c", ".i", ".cc", ".cp", ".cxx", ".cpp", ".CPP", ".c++", ".C", ".ii"}
+
+
+def compile_output(args: list[str]) -> typing.Optional[str]:
+    """Return the object file produced by "cc -c ARGS", or None if the
+       command does not compile exactly one source file."""
+    if "-c" not in args or "-E" in args or "-S" in args:
+        return None
+    sources = []
+    output = None
+    i = 0
+    while i < len(args):
+        if args[i] == "-o" and i + 1 < len(args):
+            output = args[i + 1]
+            i += 1
+        elif args[i].startswith("-o"):
+            output = args[i][2:]
+        elif not args[i].startswith("-") and os.path.splitext(args[i])[1] in SOURCE_SUFFIXES:
+            sources.append(args[i])
+        elif args[i] in ("-x", "-I", "-D", "-U", "-include", "-isystem", "-iquote", "-MF", "-MT", "-MQ"):
+            i += 1
+        i += 1
+    if len(sources) != 1:
+        return None
+    if output is None:
+        output = os.path.splitext(os.path.basename(sources[0]))[0] + ".o"
+    return os.path.abspath(output)
+
+
+def cc_main():
+    """Entry point of vrc-cc.  "vrc-cc COMPILER ARGS..." runs the compiler
+       with an RTL dump in a temporary file, and adds the edges to the store
+       in the directory given by $VRC_STORE, where "load --store" can find
+       them.  Build systems run compilers from many directories, so the
+       store must be an absolute path; otherwise the compiler runs without
+       collecting the edges."""
+    if len(sys.argv) < 2:
+        print("Usage: vrc-cc COMPILER ARGS...", file=sys.stderr)
+        sys.exit(2)
+
+    args = sys.argv[1:]
+    obj = compile_output(args[1:])
+    if obj is None:
+        sys.exit(subprocess.run(args).returncode)
+
+    # Failures of vrc-cc itself are reported, but the exit status is
+    # always the compiler's, so that the build never breaks because of it
+    store = os.environ.get("VRC_STORE", "")
+    if not os.path.isabs(store):
+        print("vrc-cc: VRC_STORE must be an absolute directory, edges not collected", file=sys.stderr)
+        sys.exit(subprocess.run(args).returncode)
+    try:
+        fd, dump = tempfile.mkstemp(prefix="vrc-", suffix=".expand")
+        os.close(fd)
+    except OSError as e:
+        print(f"vrc-cc: could not create dump file: {e}", file=sys.stderr)
+        sys.exit(subprocess.run(args).returncode)
+    try:
+        returncode = subprocess.run(args + [f"{dump_option(args)}={dump}"]).returncode
+        if returncode == 0:
+            try:
+                # With -flto the dump is only written at link time, and it is empty here
+                if os.path.getsize(dump):
+                    store_dump(store, obj, dump)
+            except Exception as e:
+                print(f"vrc-cc: could not store edges of {obj}: {e}", file=sys.stderr)
+    finally:
+        with contextlib.suppress(OSError):
+            os.unlink(dump)
+    sys.exit(returncode)
 
-                        dumps = glob.glob(fn + ".*r.expand")
-                        if not dumps:
-                            cmdline = build_gcc_S_command_line(COMPDB[fn], fn)
-                            args.verbose(f"Launching {shlex.join(cmdline)}")
-                            try:
-                                result = subprocess.run(cmdline,
-                                                        stdin=subprocess.DEVNULL)
-                            except KeyboardInterrupt:
-                                print("Interrupt", file=sys.stderr)
-                                break
-                            if result.returncode != 0:
-                                print(f"Compiler exited with return code {result.returncode}", file=sys.stderr)
-                                continue
-                            dumps = glob.glob(fn + ".*r.expand")
-                            if not dumps:
-                                print("Compiler did not produce dump file", file=sys.stderr)
-                                continue
-
-                        if len(dumps) > 1:
-                            print(f"Found more than one dump file: {', '.join(dumps)}", file=sys.stderr)
-                            continue
 
-                        print(f"Reading {os.path.relpath(dumps[0])}", file=sys.stderr)
-                        yield dumps[0]
-                    else:
-                        args.verbose(f"Reading {os.path.relpath(fn)}")
-                        yield fn
+class ExtractCommand(VRCCommand):
+    """Writes the functions and edges of GCC RTL outputs without loading them."""
+    NAME = ("extract",)
 
-        for fn in resolve(args.files):
-            with open(fn, "r") as f:
-                GRAPH.parse(fn, f, verbose_print=args.verbose)
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        def eat(*args: list[typing.Any]) -> None:
+            pass
+
+        def print_stderr(*args: list[typing.Any]) -> None:
+            print(*args, file=sys.stderr)
+
+        parser.add_argument("--verbose", action="store_const",
+                            const=print_stderr, default=eat,
+                            help="Report progress")
+        parser.add_argument("--all", action="store_true",
+                            help="Extract all object files in compile_commands.json")
+        parser.add_argument("--jobs", "-j", metavar="N", type=int, default=os.cpu_count() or 1,
+                            help="Run up to N compilers and N parsing processes in parallel")
+        parser.add_argument("--slim", action="store_true",
+                            help="Generate missing dumps in the smaller slim format")
+        parser.add_argument("--format", choices=["lines", "binary"], default="lines",
+                            help="Write tab-separated lines or length-prefixed binary records")
+        parser.add_argument("--unordered", action="store_true",
+                            help="Write each file as soon as it is parsed, not in command line order")
+        parser.add_argument("--output", "-o", metavar="FILE",
+                            help="File to be written instead of standard output")
+        parser.add_argument("files", metavar="FILE", nargs="*",
+                            help="Dump or object file to be extracted")
+
+    def run(self, args: argparse.Namespace):
+        if not args.files and not args.all:
+            raise argparse.ArgumentError(None, "extract: no files specified")
+
+        files = list(args.files)
+        if args.all:
+            files += compdb_objects()
+        binary = args.format == "binary"
+        dumps = resolve_dumps(files, args.verbose, args.jobs, args.slim)
+        sys.stdout.flush()
+        out = open(os.path.expanduser(args.output), "wb") if args.output else sys.stdout.buffer
+        try:
+            if args.jobs <= 1:
+                for fn in dumps:
+                    with open(fn, "r") as f:
+                        for chunk in extract_records(fn, f, binary, local_functions(fn)):
+                            out.write(chunk)
+                return
+
+            # Keep a bounded number of files in flight, so that memory
+            # usage does not depend on the number of files.
+            with concurrent.futures.ProcessPoolExecutor(args.jobs) as pool:
+                pending: deque[concurrent.futures.Future[bytes]] = deque()
+                for fn in dumps:
+                    pending.append(pool.submit(extract_dump, fn, binary))
+                    while len(pending) >= 2 * args.jobs:
+                        out.write(self.next_result(pending, args.unordered))
+                while pending:
+                    out.write(self.next_result(pending, args.unordered))
+        finally:
+            if args.output:
+                out.close()
+            else:
+                out.flush()
+
+    @staticmethod
+    def next_result(pending: deque[concurrent.futures.Future[bytes]], unordered: bool) -> bytes:
+        if unordered:
+            done, _ = concurrent.futures.wait(pending, return_when=concurrent.futures.FIRST_COMPLETED)
+            future = next(iter(done))
+            pending.remove(future)
+            return future.result()
+        return pending.popleft().result()
+
+
+class SaveCommand(VRCCommand):
+    """Saves the graph and the filter to a file."""
+    NAME = ("save",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("file", metavar="FILE",
+                            help="File to be written")
+
+    def run(self, args: argparse.Namespace):
+        GRAPH.save(os.path.expanduser(args.file))
+
+
+class RestoreCommand(VRCCommand):
+    """Replaces the graph and the filter with those saved by "save"."""
+    NAME = ("restore",)
+    MEMO = True
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("file", metavar="FILE",
+                            help="File to be read")
+
+    @classmethod
+    def inputs(self, args: argparse.Namespace) -> list[str]:
+        return [os.path.expanduser(args.file)]
+
+    def run(self, args: argparse.Namespace):
+        global GRAPH
+        try:
+            GRAPH = Graph.restore(os.path.expanduser(args.file))
+        except (OSError, ValueError, pickle.UnpicklingError) as e:
+            raise argparse.ArgumentError(None, f"restore: {e}")
 
 
 class NodeCommand(VRCCommand):
     """Creates a new node for a non-external symbol."""
     NAME = ("node",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -445,6 +2642,7 @@ class NodeCommand(VRCCommand):
 class EdgeCommand(VRCCommand):
     """Creates a new edge.  The caller must exist already."""
     NAME = ("edge",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -466,6 +2664,7 @@ class OmitCommand(VRCCommand):
     """Removes a node, and optionally its callers and/or callees, from
        the graph that is generated by "output" or "dotty"."""
     NAME = ("omit",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -489,10 +2688,22 @@ class OmitCommand(VRCCommand):
                     GRAPH.omit_callees(callee)
 
 
+def address_taken_roots(args: argparse.Namespace, cmd: str) -> list[str]:
+    """Return the FUNC arguments of "keep" and "only", plus the address-taken
+       functions if requested."""
+    if not args.funcs and not args.address_taken:
+        raise argparse.ArgumentError(None, f"{cmd}: no functions specified")
+    funcs = list(args.funcs)
+    if args.address_taken:
+        funcs += sorted(GRAPH.address_taken())
+    return funcs
+
+
 class KeepCommand(VRCCommand):
     """Undoes the effect of "omit" on a node, and optionally
        its callers and/or callees."""
     NAME = ("keep",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -500,18 +2711,22 @@ class KeepCommand(VRCCommand):
                             help="Keep all callers, recursively.")
         parser.add_argument("--callees", action="store_true",
                             help="Keep all callees, recursively.")
-        parser.add_argument("funcs", metavar="FUNC", nargs="+",
+        parser.add_argument("--address-taken", action="store_true",
+                            help="Also start from all functions whose address is taken.")
+        parser.add_argument("funcs", metavar="FUNC", nargs="*",
                             help="The functions to be filtered")
 
     def run(self, args: argparse.Namespace):
-        for f in args.funcs:
+        funcs = address_taken_roots(args, "keep")
+        # Closures do not depend on the filter, look them up before
+        # changing it so that prefetched results can be used
+        nodes = set(funcs)
+        if args.callers:
+            nodes |= PREFETCHER.closure(funcs, callers=True)
+        if args.callees:
+            nodes |= PREFETCHER.closure(funcs, callers=False)
+        for f in nodes:
             GRAPH.keep_node(f)
-            if args.callers:
-                for caller in GRAPH.all_callers(f):
-                    GRAPH.keep_node(caller)
-            if args.callees:
-                for callee in GRAPH.all_callees(f):
-                    GRAPH.keep_node(callee)
 
 
 class OnlyCommand(VRCCommand):
@@ -520,6 +2735,7 @@ class OnlyCommand(VRCCommand):
        If invoked multiple times, the filters are ORed.  Nodes
        added by "keep" are included too."""
     NAME = ("only",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -527,24 +2743,29 @@ class OnlyCommand(VRCCommand):
                             help="Keep all callers, recursively.")
         parser.add_argument("--callees", action="store_true",
                             help="Keep all callees, recursively.")
-        parser.add_argument("funcs", metavar="FUNC", nargs="+",
+        parser.add_argument("--address-taken", action="store_true",
+                            help="Also start from all functions whose address is taken.")
+        parser.add_argument("funcs", metavar="FUNC", nargs="*",
                             help="The functions to be filtered")
 
     def run(self, args: argparse.Namespace):
+        funcs = address_taken_roots(args, "only")
         GRAPH.filter_default = False
-        for f in args.funcs:
+        # Closures do not depend on the filter, look them up before
+        # changing it so that prefetched results can be used
+        nodes = set(funcs)
+        if args.callers:
+            nodes |= PREFETCHER.closure(funcs, callers=True)
+        if args.callees:
+            nodes |= PREFETCHER.closure(funcs, callers=False)
+        for f in nodes:
             GRAPH.keep_node(f)
-            if args.callers:
-                for caller in GRAPH.all_callers(f):
-                    GRAPH.keep_node(caller)
-            if args.callees:
-                for callee in GRAPH.all_callees(f):
-                    GRAPH.keep_node(callee)
 
 
 class ResetCommand(VRCCommand):
     """Undoes any filtering done by the "keep" or "omit" commands."""
     NAME = ("reset",)
+    MEMO = True
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
@@ -568,11 +2789,13 @@ class CallersCommand(VRCCommand):
     def run(self, args: argparse.Namespace):
         result = defaultdict(lambda: list())
         for f in args.funcs:
-            for i in GRAPH.callers(f, ref_ok=args.include_ref):
+            for i in PREFETCHER.callers(f, ref_ok=args.include_ref):
                 result[i].append(f)
 
         for caller, callees in result.items():
             print(f"{caller} -> {', '.join(callees)}")
+        PREFETCHER.note(args.funcs)
+        PREFETCHER.note(result.keys())
 
 
 class CalleesCommand(VRCCommand):
@@ -585,17 +2808,649 @@ class CalleesCommand(VRCCommand):
                             help="Include external functions.")
         parser.add_argument("--include-ref", action="store_true",
                             help="Include references to functions.")
+        parser.add_argument("--not-inlined", action="store_true",
+                            help="Only print calls that inlining remarks report as not inlined.")
         parser.add_argument("funcs", metavar="FUNC", nargs="+",
                             help="The functions to be filtered")
 
     def run(self, args: argparse.Namespace):
+        if args.not_inlined:
+            for f in args.funcs:
+                for i in GRAPH.callees(f, external_ok=args.include_external, ref_ok=False):
+                    status = GRAPH.edge_inline(f, i)
+                    if status and status.startswith("not-inlined: "):
+                        print(f"{f} -> {i}: {status[len('not-inlined: '):]}")
+            return
+
         result = defaultdict(lambda: list())
         for f in args.funcs:
-            for i in GRAPH.callees(f, external_ok=args.include_external, ref_ok=args.include_ref):
+            for i in PREFETCHER.callees(f, external_ok=args.include_external, ref_ok=args.include_ref):
                 result[i].append(f)
 
         for callee, callers in result.items():
             print(f"{', '.join(callers)} -> {callee}")
+        PREFETCHER.note(args.funcs)
+        PREFETCHER.note(result.keys())
+
+
+class MetricsCommand(VRCCommand):
+    """Prints the number of callers and callees of the specified functions,
+       or of all functions in the graph that is generated by "output"."""
+    NAME = ("metrics",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--closure", action="store_true",
+                            help="Also count callers and callees recursively.")
+        parser.add_argument("funcs", metavar="FUNC", nargs="*",
+                            help="The functions to be examined")
+
+    def run(self, args: argparse.Namespace):
+        funcs = [f for f in args.funcs or sorted(GRAPH.all_nodes()) if GRAPH.has_node(f)]
+        metrics = PREFETCHER.metrics(funcs, args.closure) if args.funcs else GRAPH.metrics(funcs, args.closure)
+        for func, m in metrics.items():
+            line = f"{func}: {m.callers} callers, {m.callees} callees"
+            if args.closure:
+                line += f", {m.all_callers} recursive callers, {m.all_callees} recursive callees"
+            print(line)
+        PREFETCHER.note(args.funcs)
+
+
+class DuplicatesCommand(VRCCommand):
+    """Prints the functions that are defined in more than one file,
+       for example inline functions and template instantiations, sorted
+       by the total number of RTL insns in all copies."""
+    NAME = ("duplicates",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--top", metavar="N", type=int,
+                            help="Only print the first N functions")
+
+    def run(self, args: argparse.Namespace):
+        dups = [n for n in GRAPH.nodes.values() if n.copies > 1]
+        dups.sort(key=lambda n: (-n.total_size, n.name))
+        for n in dups[:args.top]:
+            print(f"{GRAPH.name(n.name)}: {n.copies} copies, "
+                  f"{n.total_size // n.copies} insns each, {n.total_size} insns total")
+
+
+class CrossTUCommand(VRCCommand):
+    """Prints the calls between functions defined in different files,
+       grouped by pair of files and sorted by estimated frequency.  These
+       calls cannot be inlined without link-time optimization.  Frequencies
+       come from the profile if the dumps were generated with -fprofile-use
+       and -fdump-rtl-expand-blocks-details, which "load" and vrc-cc ask
+       for when the compile command uses profile feedback; otherwise they
+       are the number of call sites."""
+    NAME = ("cross-tu",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--top", metavar="N", type=int,
+                            help="Only print the first N pairs of files")
+        parser.add_argument("--calls", metavar="N", type=int, default=5,
+                            help="Print up to N calls for each pair of files (default 5)")
+
+    def run(self, args: argparse.Namespace):
+        pairs: dict[tuple[str, str], list[tuple[int, str, str]]] = defaultdict(list)
+        for caller in GRAPH.all_nodes():
+            caller_file = GRAPH.node_file(caller)
+            for callee in GRAPH.callees(caller, external_ok=False, ref_ok=False):
+                callee_file = GRAPH.node_file(callee)
+                if caller_file and callee_file and caller_file != callee_file:
+                    weight = GRAPH.edge_weight(caller, callee)
+                    pairs[(caller_file, callee_file)].append((weight, caller, callee))
+
+        totals = sorted(((sum(w for w, _, _ in calls), files) for files, calls in pairs.items()),
+                        key=lambda x: (-x[0], x[1]))
+        for total, (caller_file, callee_file) in totals[:args.top]:
+            print(f"{file_label(caller_file)} -> {file_label(callee_file)}: {total}")
+            calls = sorted(pairs[(caller_file, callee_file)], key=lambda x: (-x[0], x[1], x[2]))
+            for weight, caller, callee in calls[:args.calls]:
+                print(f"    {caller} -> {callee}: {weight}")
+
+
+class AddressTakenCommand(VRCCommand):
+    """Prints the functions whose address is taken, grouped by the files
+       that take it.  These are the only possible targets of indirect
+       calls; "only --address-taken" uses them as roots."""
+    NAME = ("address-taken",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--include-external", action="store_true",
+                            help="Include functions that are not defined; these may also be variables")
+        parser.add_argument("--not-called", action="store_true",
+                            help="Only print functions that are never called directly")
+
+    def run(self, args: argparse.Namespace):
+        by_file: dict[str, list[tuple[str, bool]]] = defaultdict(list)
+        for name, (files, called) in GRAPH.address_taken(external_ok=args.include_external).items():
+            if called and args.not_called:
+                continue
+            for file in files:
+                by_file[file].append((GRAPH.name(name), called))
+
+        for file in sorted(by_file, key=file_label):
+            print(f"{file_label(file) if file else '(unknown)'}:")
+            for name, called in sorted(by_file[file]):
+                print(f"    {name}{' (also called)' if called else ''}")
+
+
+class ColdCandidatesCommand(VRCCommand):
+    """Prints the functions that are only called, directly or indirectly,
+       by functions that GCC marked as unlikely executed or by the given
+       error handlers.  They could be marked __attribute__((cold)), which
+       moves their code out of the hot text.  Only the loaded files are
+       considered."""
+    NAME = ("cold-candidates",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("handlers", metavar="HANDLER", nargs="*",
+                            help="Functions that are only called on error paths")
+
+    def run(self, args: argparse.Namespace):
+        for handler in args.handlers:
+            if not GRAPH.has_node(handler):
+                raise argparse.ArgumentError(None, f"cold-candidates: {handler} not found in graph")
+        candidates = [(GRAPH.code_size(name), name) for name in GRAPH.cold_candidates(args.handlers)
+                      if GRAPH.filter_node(name, False)]
+        candidates.sort(key=lambda x: (-x[0], GRAPH.name(x[1])))
+        for size, name in candidates:
+            print(f"{size:8} {GRAPH.name(name)} ({file_label(GRAPH.nodes[name].file or '')})")
+        print(f"{len(candidates)} functions, {sum(size for size, _ in candidates)} bytes")
+
+
+class InternalizeCommand(VRCCommand):
+    """Prints the global functions that are only used by their own file,
+       ranked by their number of call sites.  Making them static lets the
+       compiler inline and clone them without LTO.  Uses from data, such as
+       vtables and tables of function pointers, are found in the undefined
+       symbols of the object files.  Only the loaded files are considered:
+       uses from other objects, libraries or assembly files, and from the
+       data of files whose object file was not found, are missed, and can
+       break the link.  Functions whose binding is not known, because
+       their own object file was not found, are marked with "?"."""
+    NAME = ("internalize",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--limit", metavar="N", type=int,
+                            help="Print only the N most called functions")
+
+    def run(self, args: argparse.Namespace):
+        undefined: dict[str, set[str]] = defaultdict(set)
+        missing = 0
+        for file in list(GRAPH.nodes_by_file):
+            obj = object_file(file)
+            if not obj.endswith(".o") or not os.path.exists(obj):
+                missing += 1
+                continue
+            for name in elf_undefined(obj):
+                undefined[name].add(file)
+        if missing:
+            print(f"{missing} object files not found, their uses from data are not checked", file=sys.stderr)
+        candidates = [(name, calls) for name, calls in GRAPH.internalize_candidates(undefined)
+                      if GRAPH.filter_node(name, False)]
+        for name, calls in candidates[:args.limit]:
+            n = GRAPH.nodes[name]
+            unknown = "?" if n.binding is None else " "
+            print(f"{calls:6} {unknown} {GRAPH.name(name)} ({file_label(n.file or '')})")
+
+
+# hfsort, the implementation of C3 in HHVM, does not merge two clusters
+# if the result is less than 1/8 as dense as the caller's cluster, so
+# that rarely executed callees do not dilute a hot cluster
+MAX_DENSITY_DEGRADATION = 8
+
+
+def call_chain_clustering(weights: dict[tuple[str, str], int], sizes: dict[str, int],
+                          max_cluster_size: int) -> list[str]:
+    """Order functions so that callers are close to their most frequent
+       callees, using the C3 heuristic (Ottoni and Maher, "Optimizing
+       Function Placement for Large-Scale Data-Center Applications").
+       Only functions with a nonzero weight are returned."""
+    hotness: dict[str, int] = defaultdict(int)
+    best_caller: dict[str, tuple[int, str]] = {}
+    for (caller, callee), weight in weights.items():
+        if caller == callee or weight <= 0:
+            continue
+        hotness[callee] += weight
+        hotness[caller] += 0
+        if callee not in best_caller or best_caller[callee] < (weight, caller):
+            best_caller[callee] = (weight, caller)
+
+    @dataclasses.dataclass
+    class Cluster:
+        members: list[str]
+        size: int
+        weight: int
+
+        def density(self) -> float:
+            return self.weight / max(self.size, 1)
+
+    cluster = {f: Cluster([f], sizes.get(f, 0), hotness[f]) for f in hotness}
+    for f in sorted(hotness, key=lambda f: (-hotness[f], f)):
+        if f not in best_caller:
+            continue
+        pred = cluster[best_caller[f][1]]
+        succ = cluster[f]
+        if pred is succ or pred.size + succ.size > max_cluster_size:
+            continue
+        # Do not merge if it makes the caller's cluster much less dense
+        merged = Cluster([], pred.size + succ.size, pred.weight + succ.weight)
+        if merged.density() * MAX_DENSITY_DEGRADATION < pred.density():
+            continue
+        # Callees are placed after the callers
+        pred.members += succ.members
+        pred.size, pred.weight = merged.size, merged.weight
+        for g in succ.members:
+            cluster[g] = pred
+
+    clusters = {id(c): c for c in cluster.values()}.values()
+    return [f
+            for c in sorted(clusters, key=lambda c: (-c.density(), c.members[0]))
+            for f in c.members]
+
+
+def call_locality(order: list[str], weights: dict[tuple[str, str], int],
+                  sizes: dict[str, int], page_size: int) -> tuple[float, float]:
+    """Return the fraction of calls (by weight) where caller and callee
+       start on the same page, and the average distance between them."""
+    address = {}
+    pos = 0
+    for f in order:
+        address[f] = pos
+        pos += sizes.get(f, 0)
+
+    total = same_page = distance = 0
+    for (caller, callee), weight in weights.items():
+        if caller not in address or callee not in address:
+            continue
+        total += weight
+        if address[caller] // page_size == address[callee] // page_size:
+            same_page += weight
+        distance += weight * abs(address[caller] - address[callee])
+    if not total:
+        return 0.0, 0.0
+    return same_page / total, distance / total
+
+
+def function_sections(funcs: typing.Iterable[str]) -> dict[str, str]:
+    """Return the section of each function, as found in the symbol table
+       of its object file.  If the object file is missing or was compiled
+       without -ffunction-sections, guess the section from the frequency of
+       the function, as GCC does: .text.hot.NAME, .text.unlikely.NAME,
+       .text.startup.NAME or .text.NAME."""
+    result = {}
+    objects: dict[str, dict[str, str]] = {}
+    for func in funcs:
+        n = GRAPH.nodes.get(func)
+        symbol = func
+        if n and n.file:
+            if n.file not in objects:
+                obj = object_file(n.file)
+                objects[n.file] = elf_function_sections(obj) if obj.endswith(".o") else {}
+            # Static functions can have a suffix, see Graph._local_names()
+            symbol = func.removesuffix(f"@{os.path.basename(object_file(n.file))}")
+            section = objects[n.file].get(symbol, "")
+            if section.endswith("." + symbol):
+                result[func] = section
+                continue
+        frequency = n.frequency if n else None
+        if frequency == "hot":
+            prefix = ".text.hot."
+        elif frequency == "unlikely executed":
+            prefix = ".text.unlikely."
+        elif frequency == "executed once" and (symbol == "main" or symbol.startswith("_GLOBAL__sub_I_")):
+            prefix = ".text.startup."
+        else:
+            prefix = ".text."
+        result[func] = prefix + symbol
+    return result
+
+
+class LayoutCommand(VRCCommand):
+    """Writes a linker symbol ordering file that places functions close
+       to their most frequent callers, and reports the expected change
+       in locality.  Call frequencies are estimated by the number of call
+       sites or by profile data in the dumps, or read from a file."""
+    NAME = ("layout",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--weights", metavar="FILE",
+                            help="Read call frequencies from FILE (lines of the form \"CALLER CALLEE COUNT\")")
+        parser.add_argument("--max-cluster-size", metavar="BYTES", type=int, default=4096,
+                            help="Maximum size of a group of functions (default 4096)")
+        parser.add_argument("--sections", action="store_true",
+                            help="Write section names for --section-ordering-file, as found in the object files")
+        parser.add_argument("file", metavar="FILE", nargs="?",
+                            help="Output file (default: standard output)")
+
+    def run(self, args: argparse.Namespace):
+        weights: dict[tuple[str, str], int] = defaultdict(int)
+        if args.weights:
+            with open(args.weights, "r") as f:
+                for line in f:
+                    words = line.split()
+                    if not words or words[0].startswith('#'):
+                        continue
+                    if len(words) != 3 or not words[2].isdigit():
+                        raise argparse.ArgumentError(None, f"layout: invalid line in weights file: {line.strip()}")
+                    weights[(words[0], words[1])] += int(words[2])
+        else:
+            for caller, callee, weight in GRAPH.weighted_calls():
+                weights[(caller, callee)] += weight
+
+        # The baseline is the order in which the functions were loaded
+        before = [f for file in GRAPH.nodes_by_file.values() for f in file]
+        before += sorted(set(f for edge in weights for f in edge).difference(before))
+        sizes = {f: GRAPH.code_size(f) for f in before}
+
+        hot = call_chain_clustering(weights, sizes, args.max_cluster_size)
+        names = function_sections(hot) if args.sections else {}
+        if args.file:
+            with open(os.path.expanduser(args.file), "w") as f:
+                for func in hot:
+                    print(names.get(func, func), file=f)
+        else:
+            for func in hot:
+                print(names.get(func, func))
+
+        hot_set = set(hot)
+        after = hot + [f for f in before if f not in hot_set]
+        page = 4096
+        old_page, old_dist = call_locality(before, weights, sizes, page)
+        new_page, new_dist = call_locality(after, weights, sizes, page)
+        print(f"Ordered {len(hot)} functions", file=sys.stderr)
+        print(f"Calls within the same {page}-byte page: {old_page:.1%} -> {new_page:.1%}", file=sys.stderr)
+        print(f"Average call distance: {old_dist:.0f} -> {new_dist:.0f} bytes", file=sys.stderr)
+
+
+def affinity_groups(files: typing.Iterable[str], weights: dict[tuple[str, str], int],
+                    max_size: int) -> list[list[str]]:
+    """Partition files into groups of at most max_size elements, greedily
+       merging the two groups with the highest weight between them.  The
+       weight left between groups that were too large to merge is used by
+       moving single files to the group they have the most weight with,
+       and then by packing each group together with the groups it has the
+       most weight with."""
+    group = {f: i for i, f in enumerate(sorted(files))}
+    members = {i: [f] for f, i in group.items()}
+    adj: dict[int, dict[int, int]] = {i: defaultdict(int) for i in members}
+    file_adj: dict[str, dict[str, int]] = {f: defaultdict(int) for f in group}
+    for (x, y), weight in weights.items():
+        if x in group and y in group and x != y and weight > 0:
+            adj[group[x]][group[y]] += weight
+            adj[group[y]][group[x]] += weight
+            file_adj[x][y] += weight
+            file_adj[y][x] += weight
+
+    heap = [(-w, a, b) for a in adj for b, w in adj[a].items() if a < b]
+    heapq.heapify(heap)
+    while heap:
+        w, a, b = heapq.heappop(heap)
+        if a not in members or b not in members or adj[a].get(b) != -w:
+            continue
+        if len(members[a]) + len(members[b]) > max_size:
+            continue
+        # Merge the group with fewer neighbors into the other
+        if len(adj[a]) < len(adj[b]):
+            a, b = b, a
+        members[a] += members.pop(b)
+        del adj[a][b]
+        for c, weight in adj.pop(b).items():
+            if c == a:
+                continue
+            del adj[c][b]
+            adj[a][c] += weight
+            adj[c][a] = adj[a][c]
+            heapq.heappush(heap, (-adj[a][c], min(a, c), max(a, c)))
+
+    # Every move increases the weight inside the groups, so this stops
+    group = {f: i for i, m in members.items() for f in m}
+    moved = True
+    while moved:
+        moved = False
+        for f in sorted(group):
+            affinity: dict[int, int] = defaultdict(int)
+            for g, weight in file_adj[f].items():
+                affinity[group[g]] += weight
+            own = group[f]
+            best = max(((w, -i) for i, w in affinity.items() if i != own and len(members[i]) < max_size),
+                       default=None)
+            if best and best[0] > affinity[own]:
+                members[own].remove(f)
+                if not members[own]:
+                    del members[own]
+                group[f] = -best[1]
+                members[group[f]].append(f)
+                moved = True
+
+    # Pack the groups largest first, each into the bin that it has the
+    # most weight with, or into the first one with room
+    bins: list[list[str]] = []
+    bin_of: dict[str, int] = {}
+    for m in sorted(members.values(), key=lambda m: (-len(m), min(m))):
+        affinity = defaultdict(int)
+        for f in m:
+            for g, weight in file_adj[f].items():
+                if g in bin_of:
+                    affinity[bin_of[g]] += weight
+        fits = [i for i in range(len(bins)) if len(bins[i]) + len(m) <= max_size]
+        if fits:
+            dest = max(fits, key=lambda i: (affinity[i], -i))
+        else:
+            dest = len(bins)
+            bins.append([])
+        bins[dest] += m
+        bin_of.update((f, dest) for f in m)
+    return sorted((sorted(dest) for dest in bins), key=lambda dest: dest[0])
+
+
+class UnityGroupsCommand(VRCCommand):
+    """Splits the loaded files into groups for a unity build, so that
+       frequent calls between files end up in the same group."""
+    NAME = ("unity-groups",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--max-size", metavar="N", type=int, required=True,
+                            help="Maximum number of files in a group")
+
+    def run(self, args: argparse.Namespace):
+        if args.max_size < 1:
+            raise argparse.ArgumentError(None, "unity-groups: --max-size must be positive")
+
+        weights: dict[tuple[str, str], int] = defaultdict(int)
+        for caller, callee, weight in GRAPH.weighted_calls():
+            caller_file = GRAPH.nodes[caller].file
+            callee_file = GRAPH.nodes[callee].file
+            if caller_file and callee_file and caller_file != callee_file:
+                weights[(caller_file, callee_file)] += weight
+
+        groups = affinity_groups(GRAPH.nodes_by_file.keys(), weights, args.max_size)
+        group_of = {f: i for i, g in enumerate(groups) for f in g}
+        total = sum(weights.values())
+        inside = sum(w for (a, b), w in weights.items() if group_of[a] == group_of[b])
+        for g in groups:
+            print(" ".join(source_file(f) for f in g))
+        if total:
+            print(f"{len(groups)} groups, {inside / total:.1%} of cross-file calls within a group",
+                  file=sys.stderr)
+
+
+def heavy_path(root: str, k: int, depth: int, limit: int,
+               external_ok: bool) -> list[tuple[str, str, int, int]]:
+    """Return the tree of heaviest calls from root as a list of (CALLER,
+       CALLEE, WEIGHT, DEPTH) in the order they were expanded.  The weight
+       of a call is its estimated frequency times the number of functions
+       reachable from the callee; only the k heaviest calls of each function
+       are followed.  The heaviest calls are expanded first, so that
+       the tree has the most important calls when it reaches limit nodes."""
+    cond = GRAPH.condensation()
+    tree: list[tuple[str, str, int, int]] = []
+    visited = {root}
+    seq = 0
+    heap: list[tuple[int, int, str]] = [(0, seq, root)]
+    levels = {root: 0}
+    while heap and len(tree) < limit:
+        _, _, func = heapq.heappop(heap)
+        if levels[func] == depth:
+            continue
+        calls = [(GRAPH.edge_weight(func, callee) * cond.closure_size(callee), callee)
+                 for callee in GRAPH.callees(func, external_ok=external_ok, ref_ok=False)
+                 if callee not in visited]
+        for weight, callee in heapq.nlargest(k, calls):
+            if len(tree) == limit:
+                break
+            visited.add(callee)
+            levels[callee] = levels[func] + 1
+            tree.append((func, callee, weight, levels[callee]))
+            seq += 1
+            heapq.heappush(heap, (-weight, seq, callee))
+    return tree
+
+
+class Footprint(typing.NamedTuple):
+    bytes: int
+    functions: int
+    unique: int                         # Bytes not reachable from other roots
+    largest: list[tuple[int, str]]      # Largest functions and their size
+
+
+def bit_planes(values: list[int]) -> list[int]:
+    """Return a bitset for each bit of the values: bit i of the j-th
+       bitset is bit j of values[i]."""
+    return [int("".join("1" if v >> j & 1 else "0" for v in reversed(values)) or "0", 2)
+            for j in range(max(values, default=0).bit_length())]
+
+
+def weighted_count(bits: int, planes: list[int]) -> int:
+    """Return the sum of the values, as split by bit_planes(), for the
+       bits that are set in a bitset."""
+    return sum(popcount(bits & p) << j for j, p in enumerate(planes))
+
+
+def footprints(roots: list[str], top: int) -> dict[str, Footprint]:
+    """Return the code size of the functions reachable from each root, with
+       the top largest ones.  The closures of all roots are computed in a
+       single visit of the condensation, ignoring the filter."""
+    cond = GRAPH.condensation()
+    names = [n.name for n in map(GRAPH._get_node, roots) if n]
+    count = Counter(cond.scc_of[name] for name in names)
+
+    # Only one closure at a time is kept: the first visit finds the nodes
+    # that are reachable from more than one root, the second one sums the
+    # sizes.  Roots in the same component have no unique functions.
+    once = twice = 0
+    for scc, b in cond.each_closure(count):
+        twice |= b if count[scc] > 1 else once & b
+        once |= b
+
+    sizes = [GRAPH.code_size(x) for x in cond.order]
+    pairs = list(zip(sizes, cond.order)) if top else []
+    planes = bit_planes(sizes)
+    by_scc = {}
+    for scc, b in cond.each_closure(count):
+        largest = heapq.nlargest(top, cond.select(b, pairs))
+        by_scc[scc] = Footprint(bytes=weighted_count(b, planes),
+                                functions=popcount(b),
+                                unique=weighted_count(b & ~twice, planes),
+                                largest=largest)
+    return {name: by_scc[cond.scc_of[name]] for name in names}
+
+
+class FootprintCommand(VRCCommand):
+    """Prints the code size of everything reachable from the given functions,
+       for example to check if a request path fits in the instruction cache.
+       Sizes come from the symbol tables of the object files if available,
+       otherwise they are estimated from the number of RTL insns."""
+    NAME = ("footprint",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--top", metavar="N", type=int,
+                            help="Print the N largest functions of each footprint "
+                                 "(default 10 with a single root, otherwise 0)")
+        parser.add_argument("--entry-points", action="store_true",
+                            help="Also start from all functions that are never called")
+        parser.add_argument("roots", metavar="ROOT", nargs="*",
+                            help="The functions to start from")
+
+    def run(self, args: argparse.Namespace):
+        roots = list(args.roots)
+        for root in roots:
+            if not GRAPH.has_node(root):
+                raise argparse.ArgumentError(None, f"footprint: {root} not found in graph")
+        if args.entry_points:
+            roots += sorted(name for name, n in GRAPH.nodes.items()
+                            if not n.external and not any(GRAPH.nodes[caller][name] == "call"
+                                                          for caller in n.callers))
+        if not roots:
+            raise argparse.ArgumentError(None, "footprint: no functions specified")
+
+        top = args.top if args.top is not None else 10 if len(roots) == 1 else 0
+        result = footprints(roots, top)
+        for name, fp in sorted(result.items(), key=lambda item: (-item[1].bytes, item[0])):
+            line = f"{GRAPH.display_name(name)}: {fp.bytes} bytes, {fp.functions} functions"
+            print(line + (f", {fp.unique} bytes unique" if len(result) > 1 else ""))
+            for size, func in fp.largest:
+                estimated = "~" if GRAPH.nodes[func].code_bytes is None else ""
+                print(f"    {estimated + str(size):>8}  {GRAPH.display_name(func)}")
+        if len(result) > 1:
+            cond = GRAPH.condensation()
+            union = cond.closure_bits(cond.scc_of[name] for name in result)
+            print(f"all roots: {sum(map(GRAPH.code_size, cond.names(union)))} bytes, "
+                  f"{popcount(union)} functions")
+
+
+class HeavyPathCommand(VRCCommand):
+    """Prints the tree of the heaviest calls starting at a function.  Calls
+       are weighted by their frequency and by the number of functions that
+       the callee can reach."""
+    NAME = ("heavy-path",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--k", metavar="K", type=int, default=3,
+                            help="Follow the K heaviest calls of each function (default 3)")
+        parser.add_argument("--depth", metavar="D", type=int, default=5,
+                            help="Stop at depth D (default 5)")
+        parser.add_argument("--limit", metavar="N", type=int, default=100,
+                            help="Stop after N calls (default 100)")
+        parser.add_argument("--include-external", action="store_true",
+                            help="Include external functions.")
+        parser.add_argument("--dot", action="store_true",
+                            help="Print a DOT graph instead of an indented tree")
+        parser.add_argument("root", metavar="ROOT",
+                            help="The function to start from")
+
+    def run(self, args: argparse.Namespace):
+        if not GRAPH.has_node(args.root):
+            raise argparse.ArgumentError(None, "heavy-path: root not found in graph")
+        root = GRAPH.display_name(args.root)
+        tree = heavy_path(root, args.k, args.depth, args.limit, args.include_external)
+        if args.dot:
+            print("digraph heavy_path {")
+            print(f'{dot_string(root)};')
+            for caller, callee, weight, _ in tree:
+                print(f'{dot_string(caller)} -> {dot_string(callee)} [label="{weight}"];')
+            print("}")
+            return
+
+        children = defaultdict(list)
+        for caller, callee, weight, _ in tree:
+            children[caller].append((weight, callee))
+        stack = [(0, root, 0)]
+        while stack:
+            weight, func, level = stack.pop()
+            print(f"{'  ' * level}{func}" + (f" ({weight})" if level else ""))
+            for weight, callee in sorted(children[func]):
+                stack.append((weight, callee, level + 1))
 
 
 class OutputCommand(VRCCommand):
@@ -612,10 +3467,191 @@ class OutputCommand(VRCCommand):
                             help="Include external functions.")
         parser.add_argument("--include-ref", action="store_true",
                             help="Include references to functions.")
-        parser.add_argument("file", metavar="FILE", nargs="?")
+        output = parser.add_mutually_exclusive_group()
+        output.add_argument("--atlas", metavar="DIR",
+                            help="Write one DOT file per cluster, plus an index graph, to DIR.")
+        parser.add_argument("--cluster", choices=["file", "directory", "community"],
+                            default="file",
+                            help="How to split the graph for --atlas (default: file).")
+        parser.add_argument("--format", choices=["dot", "callgrind"], default="dot",
+                            help="Write a DOT graph, or a callgrind profile for KCachegrind (default: dot).")
+        output.add_argument("file", metavar="FILE", nargs="?")
+
+    @staticmethod
+    def write_atlas(dir: str, cluster: str, ref_ok: bool) -> None:
+        nodes = sorted(GRAPH.all_nodes())
+        if cluster == "community":
+            cluster_of = GRAPH.communities(nodes, ref_ok=ref_ok)
+        else:
+            cluster_of = {}
+            for func in nodes:
+                file = GRAPH.node_file(func)
+                label = file_label(file) if file else "(unknown)"
+                if cluster == "directory":
+                    label = os.path.dirname(label) or "."
+                cluster_of[func] = label
+
+        members = defaultdict(list)
+        for func in nodes:
+            members[cluster_of[func]].append(func)
+
+        internal = defaultdict(list)
+        crossing: dict[tuple[str, str], int] = defaultdict(int)
+        for func in nodes:
+            for callee in GRAPH.callees(func, external_ok=False, ref_ok=ref_ok):
+                src, dst = cluster_of[func], cluster_of[callee]
+                if src == dst:
+                    internal[src].append((func, callee))
+                else:
+                    crossing[(src, dst)] += 1
+
+        shard_names = {}
+        used = {"index"}
+        for label in sorted(members):
+            base = re.sub(r'[^A-Za-z0-9_.-]+', '_', label).strip('_') or "cluster"
+            name, i = base, 1
+            while name in used:
+                i += 1
+                name = f"{base}-{i}"
+            used.add(name)
+            shard_names[label] = name + ".dot"
+
+        manifest_fn = os.path.join(dir, "atlas.json")
+        try:
+            with open(manifest_fn, "r") as f:
+                old_manifest = json.load(f)
+        except (OSError, ValueError):
+            old_manifest = {}
+
+        def write_shard(label: str) -> tuple[str, str, bool]:
+            edges = sorted(internal[label])
+            digest = hashlib.sha1(json.dumps([label, members[label], edges]).encode()).hexdigest()
+            fn = shard_names[label]
+            path = os.path.join(dir, fn)
+            if old_manifest.get(fn) == digest and os.path.exists(path):
+                return fn, digest, False
+
+            with open(path, "w") as f:
+                print(f'digraph {dot_string(label)}', "{", file=f)
+                print(f'label = {dot_string(label)};', file=f)
+                connected = set()
+                for caller, callee in edges:
+                    print(f'{dot_string(caller)} -> {dot_string(callee)};', file=f)
+                    connected.add(caller)
+                    connected.add(callee)
+                for func in members[label]:
+                    if func not in connected:
+                        print(f'{dot_string(func)};', file=f)
+                print("}", file=f)
+            return fn, digest, True
+
+        # The shards are independent, write them in parallel
+        os.makedirs(dir, exist_ok=True)
+        with concurrent.futures.ThreadPoolExecutor() as pool:
+            results = list(pool.map(write_shard, sorted(members)))
+
+        with open(os.path.join(dir, "index.dot"), "w") as f:
+            print("digraph atlas {", file=f)
+            print("node [shape=box];", file=f)
+            for label in sorted(members):
+                # "\n" is a line break in the label
+                text = dot_string(label)[:-1] + f'\\n{len(members[label])} functions"'
+                print(f'{dot_string(label)} [URL={dot_string(shard_names[label])}, label={text}];', file=f)
+            for (src, dst), count in sorted(crossing.items()):
+                print(f'{dot_string(src)} -> {dot_string(dst)} [label="{count}"];', file=f)
+            print("}", file=f)
+
+        manifest = {fn: digest for fn, digest, _ in results}
+        for fn in old_manifest:
+            if fn not in manifest and os.path.exists(os.path.join(dir, fn)):
+                os.unlink(os.path.join(dir, fn))
+        with open(manifest_fn, "w") as f:
+            json.dump(manifest, f, indent=0, sort_keys=True)
+
+        written = sum(1 for _, _, changed in results if changed)
+        print(f"Wrote {written} of {len(results)} shards to {dir}", file=sys.stderr)
+
+    @staticmethod
+    def edge_style(caller: str, callee: str) -> str:
+        # Calls that were not inlined are red, thicker if they are frequent
+        status = GRAPH.edge_inline(caller, callee)
+        if not status or not status.startswith("not-inlined: "):
+            return ""
+        reason = status[len("not-inlined: "):].replace('"', "'")
+        penwidth = 1 + math.log10(max(1, GRAPH.edge_weight(caller, callee)))
+        return f' [color=red, penwidth={penwidth:.1f}, tooltip="{reason}"]'
+
+    @staticmethod
+    def write_callgrind(f: typing.TextIO, external_ok: bool) -> None:
+        """Write the filtered graph as a callgrind profile.  The cost of a
+           function is its number of RTL insns.  KCachegrind takes the cost
+           of a call as the inclusive cost of the callee, so it is the
+           number of insns of all the functions that the callee reaches,
+           ignoring the filter and the profile like "footprint".  A function
+           that is reached through several calls is part of the cost of
+           each, so it can count more than once in the inclusive cost of the
+           caller.  The number of calls is estimated by edge_weight(); calls
+           that the profile says are never executed are not written."""
+        ids: dict[str, dict[str, int]] = {"fl": {}, "fn": {}}
+        cond = GRAPH.condensation()
+        planes = bit_planes([GRAPH.insns(x) for x in cond.order])
+        inclusive = {scc: weighted_count(b, planes)
+                     for scc, b in cond.each_closure(set(cond.scc_of.values()))}
+
+        def compress(kind: str, name: str) -> str:
+            # Names are written in full only the first time
+            if name in ids[kind]:
+                return f"({ids[kind][name]})"
+            ids[kind][name] = len(ids[kind]) + 1
+            return f"({ids[kind][name]}) {name}"
+
+        def file_of(func: str) -> str:
+            file = GRAPH.node_file(func)
+            return source_file(file) if file else "(external)"
+
+        def inclusive_insns(func: str) -> int:
+            n = GRAPH._get_node(func)
+            return inclusive[cond.scc_of[n.name]] if n else 0
+
+        print("# callgrind format", file=f)
+        print("version: 1", file=f)
+        print("creator: vrc", file=f)
+        print("positions: line", file=f)
+        print("events: Insns", file=f)
+        total = 0
+        for func in GRAPH.all_nodes():
+            size = GRAPH.insns(func)
+            total += size
+            file = file_of(func)
+            print(file=f)
+            print(f"fl={compress('fl', file)}", file=f)
+            print(f"fn={compress('fn', func)}", file=f)
+            print(f"0 {size}", file=f)
+            for callee in GRAPH.callees(func, external_ok=external_ok, ref_ok=False):
+                weight = GRAPH.edge_weight(func, callee)
+                if not weight:
+                    continue
+                callee_file = file_of(callee)
+                if callee_file != file:
+                    print(f"cfl={compress('fl', callee_file)}", file=f)
+                print(f"cfn={compress('fn', callee)}", file=f)
+                print(f"calls={weight} 0", file=f)
+                print(f"0 {inclusive_insns(callee)}", file=f)
+        print(file=f)
+        print(f"totals: {total}", file=f)
 
     def run(self, args: argparse.Namespace):
+        if args.atlas:
+            if args.format != "dot":
+                raise argparse.ArgumentError(None, "output: --atlas only supports DOT format")
+            self.write_atlas(os.path.expanduser(args.atlas), args.cluster, args.include_ref)
+            return
+
         def emit(f):
+            if args.format == "callgrind":
+                self.write_callgrind(f, args.include_external)
+                return
+
             print("digraph callgraph {", file=f)
             nodes = set()
             for func in GRAPH.all_nodes():
@@ -625,13 +3661,13 @@ class OutputCommand(VRCCommand):
                 i = 0
                 for file in GRAPH.nodes_by_file.keys():
                     file_nodes = list(GRAPH.all_nodes_for_file(file))
-                    label = re.match(r'(.*?)\.[0-9]*r\.expand', os.path.relpath(file)).group(1)
+                    label = file_label(file)
                     if not file_nodes:
                         continue
                     print(f"subgraph cluster_{i}", "{", file=f)
-                    print(f'label = "{label}";', file=f)
+                    print(f'label = {dot_string(label)};', file=f)
                     for func in file_nodes:
-                        print(f'"{func}";', file=f)
+                        print(f'{dot_string(func)};', file=f)
                     print("}", file=f)
                     i += 1
 
@@ -639,7 +3675,12 @@ class OutputCommand(VRCCommand):
             for func in nodes:
                 has_edges = False
                 for i in GRAPH.callees(func, external_ok=args.include_external, ref_ok=args.include_ref):
-                    print(f'"{func}" -> "{i}";', file=f)
+                    print(f'{dot_string(func)} -> {dot_string(i)}{self.edge_style(func, i)};', file=f)
+                    connected.add(i)
+                    has_edges = True
+                for i in GRAPH.inlined_callees(func):
+                    print(f'{dot_string(func)} -> {dot_string(i)} [style=dashed, color=gray, tooltip="inlined"];',
+                          file=f)
                     connected.add(i)
                     has_edges = True
                 if has_edges:
@@ -647,7 +3688,7 @@ class OutputCommand(VRCCommand):
 
             for func in nodes:
                 if func not in connected:
-                    print(f'"{func}";', file=f)
+                    print(f'{dot_string(func)};', file=f)
 
             print("}", file=f)
 
@@ -674,6 +3715,175 @@ class OutputCommand(VRCCommand):
             emit(sys.stdout)
 
 
+def load_snapshot(path: str, verbose_print) -> Graph:
+    """Load either a directory of RTL dumps or a file written by "save"."""
+    if not os.path.isdir(path):
+        return Graph.restore(path)
+    graph = Graph()
+    for fn in sorted(glob.glob(os.path.join(path, "**", "*r.expand"), recursive=True)):
+        with open(fn, "r") as f:
+            graph.parse(fn, f, verbose_print=verbose_print, local=local_functions(fn))
+    return graph
+
+
+def bisect_snapshots(snapshots: typing.Sequence[str], evaluate: typing.Callable[[Graph], typing.Any],
+                     verbose_print) -> typing.Optional[tuple[int, typing.Any, typing.Any]]:
+    """Find the first snapshot where evaluate() returns a different value
+       than for the first one, assuming the value changes only once.  Only
+       O(log n) snapshots are loaded.  Return the index of the snapshot and
+       the values before and after it, or None if the last snapshot has the
+       same value as the first."""
+    values = {}
+
+    def value(i: int) -> typing.Any:
+        if i not in values:
+            print(f"Loading {snapshots[i]}", file=sys.stderr)
+            values[i] = evaluate(load_snapshot(snapshots[i], verbose_print))
+        return values[i]
+
+    lo, hi = 0, len(snapshots) - 1
+    if value(lo) == value(hi):
+        return None
+    while hi - lo > 1:
+        mid = (lo + hi) // 2
+        if value(mid) == value(lo):
+            lo = mid
+        else:
+            hi = mid
+    return hi, value(lo), value(hi)
+
+
+def bisect_args(parser: argparse.ArgumentParser, snapshots: bool = True) -> None:
+    def eat(*args: list[typing.Any]) -> None:
+        pass
+
+    def print_stderr(*args: list[typing.Any]) -> None:
+        print(*args, file=sys.stderr)
+
+    parser.add_argument("--verbose", action="store_const",
+                        const=print_stderr, default=eat,
+                        help="Report progress while parsing")
+    if snapshots:
+        parser.add_argument("snapshots", metavar="SNAPSHOT", nargs="+",
+                            help="Directories of RTL dumps or saved graphs, from oldest to newest")
+
+
+def print_bisect(args: argparse.Namespace, evaluate: typing.Callable[[Graph], typing.Any]) -> None:
+    snapshots = [os.path.expanduser(x) for x in args.snapshots]
+    try:
+        result = bisect_snapshots(snapshots, evaluate, args.verbose)
+    except (OSError, ValueError, pickle.UnpicklingError) as e:
+        raise argparse.ArgumentError(None, f"{args.cmd}: {e}")
+    if result is None:
+        print(f"No change between {snapshots[0]} and {snapshots[-1]}")
+    else:
+        i, before, after = result
+        print(f"First changed in {snapshots[i]}: {before} -> {after}")
+
+
+class BisectEdgeCommand(VRCCommand):
+    """Finds the first snapshot in which an edge appears or disappears."""
+    NAME = ("bisect-edge",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("caller", metavar="CALLER",
+                            help="Source node of the edge")
+        parser.add_argument("callee", metavar="CALLEE",
+                            help="Target node of the edge")
+        bisect_args(parser)
+
+    def run(self, args: argparse.Namespace):
+        print_bisect(args, lambda graph: graph.has_edge(args.caller, args.callee))
+
+
+# The metrics of "bisect-metric", with the number of functions they take
+METRICS: dict[str, tuple[int, typing.Callable[..., typing.Any]]] = {
+    "callers": (1, lambda graph, f: sum(1 for _ in graph.callers(f, True))),
+    "callees": (1, lambda graph, f: sum(1 for _ in graph.callees(f, True, True))),
+    "all_callers": (1, lambda graph, f: max(0, sum(1 for _ in graph.all_callers(f)) - 1)),
+    "all_callees": (1, lambda graph, f: max(0, sum(1 for _ in graph.all_callees(f)) - 1)),
+    "size": (1, lambda graph, f: graph.code_size(f)),
+    "defined": (1, lambda graph, f: graph.filter_node(f, False)),
+    "edge": (2, lambda graph, f, g: graph.has_edge(f, g)),
+    "nodes": (0, lambda graph: sum(1 for _ in graph.all_nodes())),
+}
+
+METRIC_OPERATORS: dict[str, typing.Callable[[typing.Any, int], bool]] = {
+    "<": lambda x, y: x < y,
+    "<=": lambda x, y: x <= y,
+    ">": lambda x, y: x > y,
+    ">=": lambda x, y: x >= y,
+    "==": lambda x, y: x == y,
+    "!=": lambda x, y: x != y,
+}
+
+
+class BisectMetricCommand(VRCCommand):
+    """Finds the first snapshot in which the value of a metric changes.
+       The metric is one of callers F, callees F, all_callers F,
+       all_callees F, size F, defined F, edge F G and nodes, optionally
+       followed by a comparison with a number, for example
+       "bisect-metric all_callees main > 1000 SNAPSHOT...".  Quote the
+       operator in the shell."""
+    NAME = ("bisect-metric",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("metric", metavar="METRIC", choices=sorted(METRICS),
+                            help=f"Metric to be computed on each snapshot: {', '.join(sorted(METRICS))}")
+        parser.add_argument("words", metavar="ARG", nargs="+",
+                            help="Functions taken by the metric, then optionally an operator "
+                                 f"({', '.join(METRIC_OPERATORS)}) and a number, then the "
+                                 "directories of RTL dumps or saved graphs, from oldest to newest")
+        bisect_args(parser, snapshots=False)
+
+    @staticmethod
+    def parse_metric(metric: str, words: list[str]) -> tuple[typing.Callable[[Graph], typing.Any], list[str]]:
+        """Split the words after the metric into its functions, the optional
+           comparison and the snapshots.  Return a function that computes
+           the metric on a graph, and the snapshots."""
+        arity, func = METRICS[metric]
+        if len(words) <= arity:
+            raise argparse.ArgumentError(None, f"bisect-metric: {metric} takes {arity} function(s) "
+                                               "and at least one snapshot")
+        funcs, words = words[:arity], words[arity:]
+        if words[0] not in METRIC_OPERATORS:
+            return lambda graph: func(graph, *funcs), words
+        if len(words) < 3:
+            raise argparse.ArgumentError(None, f"bisect-metric: {words[0]} needs a number "
+                                               "and at least one snapshot")
+        op = METRIC_OPERATORS[words[0]]
+        try:
+            threshold = int(words[1])
+        except ValueError:
+            raise argparse.ArgumentError(None, f"bisect-metric: invalid number {words[1]}")
+        return lambda graph: op(func(graph, *funcs), threshold), words[2:]
+
+    def run(self, args: argparse.Namespace):
+        evaluate, args.snapshots = self.parse_metric(args.metric, args.words)
+        print_bisect(args, evaluate)
+
+
+class PrefetchCommand(VRCCommand):
+    """Enables or disables computing, while waiting for input, the callers,
+       callees and closures of the functions printed by the last command."""
+    NAME = ("prefetch",)
+
+    @classmethod
+    def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("state", choices=["on", "off"], nargs="?",
+                            help="New state; print the current state if omitted")
+
+    def run(self, args: argparse.Namespace):
+        if args.state is None:
+            print("on" if PREFETCHER.enabled else "off")
+            return
+        PREFETCHER.enabled = args.state == "on"
+        PREFETCHER.names = []
+        PREFETCHER.cache = {}
+
+
 class QuitCommand(VRCCommand):
     """Exits VRC."""
     NAME = ("q", "quit")
@@ -704,27 +3914,189 @@ class HelpCommand(VRCCommand):
             PARSER.print_help()
 
 
+def file_digest(fn: str, cache: dict[str, list[typing.Any]]) -> str:
+    """Return a hash of the contents of a file.  The hash is only computed
+       again if the modification time or the size differ from the cache."""
+    try:
+        st = os.stat(fn)
+    except OSError:
+        return "missing"
+    key = os.path.abspath(fn)
+    stamp = [st.st_mtime_ns, st.st_size]
+    if key in cache and cache[key][:2] == stamp:
+        return str(cache[key][2])
+    h = hashlib.sha1()
+    try:
+        with open(fn, "rb") as f:
+            for block in iter(lambda: f.read(1 << 20), b""):
+                h.update(block)
+    except OSError:
+        return "unreadable"
+    cache[key] = stamp + [h.hexdigest()]
+    return h.hexdigest()
+
+
+@contextlib.contextmanager
+def scratch_compdb() -> typing.Iterator[None]:
+    """Undo the changes to the compilation database and the compile times
+       when the block ends."""
+    global COMPILE_TIMES_FILE
+    # A single deepcopy keeps the lists in EQUIVALENT_OBJECTS shared
+    compdb, equivalent, times = copy.deepcopy((COMPDB, EQUIVALENT_OBJECTS, COMPILE_TIMES))
+    times_file = COMPILE_TIMES_FILE
+    try:
+        yield
+    finally:
+        COMPDB.clear()
+        COMPDB.update(compdb)
+        EQUIVALENT_OBJECTS.clear()
+        EQUIVALENT_OBJECTS.update(equivalent)
+        COMPILE_TIMES.clear()
+        COMPILE_TIMES.update(times)
+        COMPILE_TIMES_FILE = times_file
+
+
+class SourceMemo:
+    """Snapshots for "source --memo", kept in .vrc-memo next to the script.
+       The leading commands of the script that only change the state are
+       fingerprinted one by one, each fingerprint covering the previous one,
+       the command line and the contents of the files that it reads.  The
+       state after these commands is saved, and a later run whose commands
+       start with the same fingerprints restores it instead of running them."""
+    def __init__(self, script: str) -> None:
+        self.dir = os.path.join(os.path.dirname(os.path.abspath(script)), ".vrc-memo")
+        self.base = os.path.join(self.dir, os.path.basename(script))
+        self.digests_file = os.path.join(self.dir, "digests.json")
+        self.digests: dict[str, list[typing.Any]] = {}
+        try:
+            with open(self.digests_file, "r") as f:
+                self.digests = json.load(f)
+        except (OSError, ValueError):
+            pass
+
+    def prefix(self, lines: list[str]) -> list[tuple[int, str]]:
+        """Return the index and the fingerprint of each leading command
+           that only changes the state."""
+        result = []
+        h = hashlib.sha256()
+        # The inputs of "load --all" come from the compilation database,
+        # so they are computed after the earlier "compdb" commands have
+        # run on a copy of it
+        with scratch_compdb():
+            for i, line in enumerate(lines):
+                argv = line.split()
+                if not argv or argv[0].startswith("#"):
+                    continue
+                try:
+                    args = PARSER.parse_args(argv)
+                except argparse.ArgumentError:
+                    break
+                if not args.cmdclass.MEMO:
+                    break
+                h.update(" ".join(argv).encode() + b"\0")
+                for fn in args.cmdclass.inputs(args):
+                    h.update(f"{fn}\0{file_digest(fn, self.digests)}\0".encode())
+                result.append((i, h.hexdigest()))
+                if args.cmdclass.CHANGES_INPUTS:
+                    try:
+                        args.cmdclass().run(args)
+                    except (OSError, ValueError, KeyError):
+                        # The command will fail again when the script runs
+                        break
+        return result
+
+    def restore(self, prefix: list[tuple[int, str]]) -> int:
+        """Restore the saved state if it matches the beginning of prefix,
+           and return the number of commands that it covers."""
+        global GRAPH, COMPILE_TIMES_FILE
+        try:
+            with open(self.base + ".key", "r") as f:
+                count, fingerprint = f.read().split()
+            if not 0 < int(count) <= len(prefix) or prefix[int(count) - 1][1] != fingerprint:
+                return 0
+            with open(self.base + ".pickle", "rb") as f:
+                saved = pickle.load(f)
+        except (OSError, ValueError, EOFError, pickle.UnpicklingError):
+            return 0
+        if len(saved) != 6 or saved[0] != fingerprint:
+            return 0
+        GRAPH = saved[1]
+        COMPDB.clear()
+        COMPDB.update(saved[2])
+        EQUIVALENT_OBJECTS.clear()
+        EQUIVALENT_OBJECTS.update(saved[3])
+        COMPILE_TIMES.clear()
+        COMPILE_TIMES.update(saved[4])
+        COMPILE_TIMES_FILE = saved[5]
+        print(f"Restored the state after {count} commands from {os.path.relpath(self.base)}.pickle",
+              file=sys.stderr)
+        return int(count)
+
+    def save(self, prefix: list[tuple[int, str]]) -> None:
+        fingerprint = prefix[-1][1]
+        # The pickle has a copy of the fingerprint in case the key is stale
+        with GRAPH.lock.read():
+            state = (fingerprint, GRAPH, COMPDB, EQUIVALENT_OBJECTS, COMPILE_TIMES, COMPILE_TIMES_FILE)
+            self.write(self.base + ".pickle", "wb",
+                       lambda f: pickle.dump(state, f, protocol=pickle.HIGHEST_PROTOCOL))
+        self.write(self.base + ".key", "w", lambda f: f.write(f"{len(prefix)} {fingerprint}\n"))
+
+    def save_digests(self) -> None:
+        self.write(self.digests_file, "w", lambda f: json.dump(self.digests, f))
+
+    def write(self, fn: str, mode: str, writer: typing.Callable[[typing.Any], typing.Any]) -> None:
+        os.makedirs(self.dir, exist_ok=True)
+        tmp = f"{fn}.{os.getpid()}.tmp"
+        with open(tmp, mode) as f:
+            writer(f)
+        os.replace(tmp, fn)
+
+
 class SourceCommand(VRCCommand):
     """Processes the commands in a file."""
     NAME = ("source",)
 
     @classmethod
     def args(self, parser: argparse.ArgumentParser):
+        parser.add_argument("--memo", action="store_true",
+                            help="Save the state after the leading commands that only change it "
+                                 "(compdb, load, omit...) and reuse it if they are unchanged")
         parser.add_argument("file", metavar="FILE")
 
     def run(self, args: argparse.Namespace):
         with open(args.file, "r") as f:
-            self.do_source(f, exit_first=True)
+            if not args.memo:
+                self.do_source(f, exit_first=True)
+                return
+            lines = f.readlines()
+
+        memo = SourceMemo(args.file)
+        prefix = memo.prefix(lines)
+        if prefix:
+            memo.save_digests()
+        start = 0
+        done = memo.restore(prefix)
+        if done:
+            start = prefix[done - 1][0] + 1
+        if done < len(prefix):
+            end = prefix[-1][0] + 1
+            if not self.do_source(iter(lines[start:end]), exit_first=True):
+                return
+            memo.save(prefix)
+            start = end
+        self.do_source(iter(lines[start:]), exit_first=True)
 
     @staticmethod
-    def do_source(inf: io.TextIOWrapper, exit_first: bool):
+    def do_source(inf: typing.Iterator[str], exit_first: bool) -> bool:
+        """Run the commands in inf.  Return False if a command failed
+           and exit_first is True, or if the user interrupted."""
         while True:
             try:
                 line = next(inf)
             except KeyboardInterrupt:
-                break
+                return False
             except StopIteration:
-                break
+                return True
 
             line = line.strip()
             if line.startswith('#'):
@@ -740,11 +4112,11 @@ class SourceCommand(VRCCommand):
                 except OSError as e:
                     print(e)
                     if exit_first:
-                        break
+                        return False
             except argparse.ArgumentError as e:
                 print(e, file=sys.stderr)
                 if exit_first:
-                    break
+                    return False
 
 
 class ReadlineInput:
@@ -759,11 +4131,14 @@ class ReadlineInput:
         return self
 
     def __next__(self):
+        PREFETCHER.start()
         try:
             return input(self.prompt)
         except EOFError:
             print()
             raise StopIteration
+        finally:
+            PREFETCHER.cancel()
 
     def complete(self, text: str, state: int) -> typing.Optional[str]:
         if state == 0:
@@ -811,7 +4186,7 @@ class ReadlineInput:
             opts = sorted(HelpCommand.PARSERS[words[0]]._option_string_actions.keys())
 
         args = []
-        if words[0] in ['callers', 'callees', 'keep', 'omit', 'edge']:
+        if words[0] in ['callers', 'callees', 'keep', 'omit', 'edge', 'metrics']:
             # complete by function name
             args = sorted(set(GRAPH.nodes_by_username.keys()).union(GRAPH.nodes.keys()))
         elif words[0] in ['pwd']:
@@ -871,6 +4246,16 @@ def main():
         except OSError as e:
             print("Could not load compile_commands.json:", e, file=sys.stderr)
 
+    # "vrc COMMAND ARGS..." runs a single command, for example "extract"
+    if len(sys.argv) > 1:
+        try:
+            args = PARSER.parse_args(sys.argv[1:])
+            args.cmdclass().run(args)
+        except (argparse.ArgumentError, OSError) as e:
+            print(e, file=sys.stderr)
+            sys.exit(1)
+        return
+
     if os.isatty(0):
         inf = ReadlineInput("(vrc) ")
     else:
@@ -0,0 +1,83 @@
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+"""pytest plugin that provides the session-scoped vrc_graph fixture, a
+vrc.CallGraph for the project.  The graph is given in the ini file or
+on the command line, either as a file written by "vrc save" or as RTL
+dumps, vrc-cc files and directories containing them:
+
+    [pytest]
+    vrc_graph = build
+
+    def test_irq_does_not_allocate(vrc_graph):
+        assert not vrc_graph.reaches("irq_handler", "malloc")
+
+Dumps are parsed once and the graph is saved in the pytest cache under a
+hash of their contents.  Later sessions, and the other workers of
+pytest-xdist, restore it from there."""
+
+import fcntl
+import hashlib
+import json
+import os
+import typing
+
+import pytest
+
+import vrc
+
+
+def pytest_addoption(parser: pytest.Parser) -> None:
+    parser.addini("vrc_graph", type="linelist",
+                  help="Saved graph, RTL dumps or directories for the vrc_graph fixture")
+    parser.addoption("--vrc-graph", action="append", metavar="PATH",
+                     help="Saved graph, RTL dump or directory for the vrc_graph fixture")
+
+
+def load_cached(paths: list[str], cache_dir: str) -> vrc.CallGraph:
+    """Load the graph for paths, parsing them only if the graph is not
+       in cache_dir already.  A lock ensures that concurrent sessions
+       parse the dumps only once."""
+    os.makedirs(cache_dir, exist_ok=True)
+    with open(os.path.join(cache_dir, "lock"), "w") as lock:
+        fcntl.flock(lock, fcntl.LOCK_EX)
+        digests_file = os.path.join(cache_dir, "digests.json")
+        digests: dict[str, list[typing.Any]] = {}
+        try:
+            with open(digests_file, "r") as f:
+                digests = json.load(f)
+        except (OSError, ValueError):
+            pass
+
+        h = hashlib.sha256()
+        for fn in vrc.CallGraph.inputs(paths):
+            h.update(f"{fn}\0{vrc.file_digest(fn, digests)}\0".encode())
+        graph_file = os.path.join(cache_dir, h.hexdigest()[:32] + ".pickle")
+        if os.path.exists(graph_file):
+            return vrc.CallGraph.restore(graph_file)
+
+        graph = vrc.CallGraph.load(paths)
+        for old in os.listdir(cache_dir):
+            if old.endswith(".pickle"):
+                os.unlink(os.path.join(cache_dir, old))
+        graph.save(graph_file + ".tmp")
+        os.replace(graph_file + ".tmp", graph_file)
+        with open(digests_file + ".tmp", "w") as f:
+            json.dump(digests, f)
+        os.replace(digests_file + ".tmp", digests_file)
+        return graph
+
+
+@pytest.fixture(scope="session")
+def vrc_graph(pytestconfig: pytest.Config) -> vrc.CallGraph:
+    """The call graph of the project, shared by all tests.  Do not modify it."""
+    paths = [os.path.abspath(p) for p in pytestconfig.getoption("vrc_graph") or []]
+    if not paths:
+        paths = [os.path.join(pytestconfig.rootpath, p) for p in pytestconfig.getini("vrc_graph")]
+    if not paths:
+        pytest.skip("no call graph given with --vrc-graph or the vrc_graph ini option")
+    if len(paths) == 1 and os.path.isfile(paths[0]) and not paths[0].endswith((".expand", ".vrc")):
+        return vrc.CallGraph.restore(paths[0])
+    cache = getattr(pytestconfig, "cache", None)
+    if cache is None:
+        return vrc.CallGraph.load(paths)
+    return load_cached(paths, str(cache.mkdir("vrc")))